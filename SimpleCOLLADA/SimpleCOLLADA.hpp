@@ -7,7 +7,37 @@
 #include <vector>
 #include <fstream>
 #include <sstream>
+#include <iostream>
 #include <unordered_map>
+#include <map>
+#include <cmath>
+#include <cstring>
+#include <cstdio>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <memory>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdlib>
+#include <algorithm>
+#ifdef SIMPLECOLLADA_ENABLE_SPILL
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#endif
 using namespace std;
 using namespace rapidxml;
 
@@ -17,14 +47,17 @@ namespace SimpleCOLLADA {
 		 attribute; attribute = attribute->next_attribute()
 	#define XML_NODE_CHILD_FOR_LOOP(node) xml_node<> *child = node->first_node(); \
 		 child; child = child->next_sibling()
-	#define EXISTS(node) node != NULL
+	#define EXISTS(node) ((node) != NULL)
 	#define NOT_FOUND -1
 	#define FOUND(i) i != NOT_FOUND
 	#define FOUND_XYZ(x,y,z) (FOUND(x) && FOUND(y) && FOUND(z))
 	#define FOUND_ST(s, t) (FOUND(s) && FOUND(t))
 	#define MAX_ABC(a,b,c) (a > b ? (a > c ? a : c) : (b > c ? b : c))
 	#define BYTES_TO_UINT(a,b,c,d) ((a << 24) | (b << 16) | (c << 8) | d)
-	#define ID_SUBSTR(str) string(str).substr(1,string(str).length()-1)
+	#define ID_SUBSTR(str) ((str) + ((str)[0] == '#' ? 1 : 0)) // Skips the '#' of a URL without copying it
+	#define STR_EQUALS(str, size, literal) ((size) == sizeof(literal) - 1 && memcmp(str, literal, sizeof(literal) - 1) == 0)
+	#define NAME_EQUALS(xml, literal) STR_EQUALS((xml)->name(), (xml)->name_size(), literal)
+	#define VALUE_EQUALS(xml, literal) STR_EQUALS((xml)->value(), (xml)->value_size(), literal)
 	#define ERROR_MSG(str) cerr << str << endl;
 	#define ERROR_MSG_NO_FIND(str) cerr << "Could not find: \"" << str << "\"" << endl;
 	#define FLAG(str) cout << "FLAG " << str << endl;
@@ -40,6 +73,300 @@ namespace SimpleCOLLADA {
 		X_UP, Y_UP, Z_UP, INVALID, NO_FIND 
 	};
 
+	enum NORMAL_WEIGHTING {
+		AREA_WEIGHTED, ANGLE_WEIGHTED
+	};
+
+	/* 
+	 * Where the XML document's memory pool, the file's buffer, the lookup tables keyed by the document (ids, sids, 
+	 * materials and effects) and the ModelNodes' geometry arrays get their memory from (LoadOptions::allocator). 
+	 * That's nearly all of a load's memory. The rest still uses new: the Model, ModelNode and Material objects 
+	 * themselves and the Model's lists of them, names and filenames, the small per-node lists (texture coordinate 
+	 * sets, vertex color groups and their names), the effect records, the context's list of spare pool blocks, and 
+	 * scratch buffers that only live during a call (visitor batches, alphaGroup's alphas, generateNormals' working arrays).
+	 * Both functions have to be set, or new and delete get used. allocate should throw instead of returning NULL, 
+	 * and deallocate gets the same size that was allocated.
+	 */
+	typedef struct _AllocatorHooks {
+		void* (*allocate)(size_t size, void* user) = NULL;
+		void (*deallocate)(void* memory, size_t size, void* user) = NULL;
+		void* user = NULL; // Passed to both, for an arena or a tracking allocator
+		inline bool isSet() const { return EXISTS(allocate) && EXISTS(deallocate); }
+		inline void* alloc(size_t size) const { return isSet() ? allocate(size, user) : ::operator new(size); }
+		inline void release(void* memory, size_t size) const {
+			if (isSet()) deallocate(memory, size, user);
+			else ::operator delete(memory);
+		}
+	} AllocatorHooks;
+
+	// Standard allocator that goes through AllocatorHooks, for the containers that hold a Model's data
+	template<typename T>
+	class HookAllocator {
+	public:
+		typedef T value_type;
+		AllocatorHooks hooks;
+		HookAllocator() {}
+		HookAllocator(const AllocatorHooks& hooks) : hooks(hooks) {}
+		template<typename U> HookAllocator(const HookAllocator<U>& other) : hooks(other.hooks) {}
+		inline T* allocate(size_t n) { return (T*)hooks.alloc(n * sizeof(T)); }
+		inline void deallocate(T* p, size_t n) { hooks.release(p, n * sizeof(T)); }
+	};
+	template<typename T, typename U>
+	inline bool operator==(const HookAllocator<T>& a, const HookAllocator<U>& b) {
+		return a.hooks.allocate == b.hooks.allocate && a.hooks.deallocate == b.hooks.deallocate && a.hooks.user == b.hooks.user;
+	}
+	template<typename T, typename U>
+	inline bool operator!=(const HookAllocator<T>& a, const HookAllocator<U>& b) { return !(a == b); }
+
+	template<typename T> using HookVector = vector<T, HookAllocator<T>>;
+	typedef basic_string<char, char_traits<char>, HookAllocator<char>> HookString;
+
+#ifdef SIMPLECOLLADA_ENABLE_SPILL
+	/* 
+	 * Only there when SIMPLECOLLADA_ENABLE_SPILL is defined before including SimpleCOLLADA.hpp, since it needs the
+	 * platform's file mapping headers.
+	 * Keeps a Model's geometry under LoadOptions::memoryBudget bytes of RAM. Arrays that would go over it are put in 
+	 * a memory-mapped temporary file instead, which the OS pages in and out as they're used, so the ModelNodes' 
+	 * pointers work the same either way. Arrays smaller than MIN_SPILL_SIZE always stay in memory.
+	 * There's one file per SpillAllocator, made on the first spill. Each array maps its own region of it, rounded up to
+	 * MIN_SPILL_SIZE, and the regions of freed arrays are reused, so a vector growing in it doesn't make a file each time.
+	 * If the file can't be made or grown, the array goes in memory after all.
+	 */
+	class SpillAllocator {
+	private:
+		typedef struct _Region {
+			size_t offset, size; // In the file
+		} Region;
+		AllocatorHooks hooks; // Where arrays that stay in memory go
+		size_t budget;
+		string directory;
+		atomic<size_t> residentBytes, mappedBytes;
+		mutex mappedMutex; // Guards everything below
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+#else
+		int file = -1;
+#endif
+		bool fileFailed = false;
+		size_t fileSize = 0;
+		map<size_t, size_t> freeRegions; // Offset to size, of the parts of the file no array is in
+		unordered_map<void*, Region> mapped;
+		bool warned = false;
+
+		bool openFile() {
+			if (fileFailed)
+				return false;
+#ifdef _WIN32
+			if (file != INVALID_HANDLE_VALUE)
+				return true;
+			char tempDir[MAX_PATH + 1], path[MAX_PATH + 1];
+			if ((directory.empty() && GetTempPathA(sizeof(tempDir), tempDir) == 0) ||
+				GetTempFileNameA(directory.empty() ? tempDir : directory.c_str(), "SCD", 0, path) == 0) {
+				fileFailed = true;
+				return false;
+			}
+			file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, 
+				FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+			fileFailed = file == INVALID_HANDLE_VALUE;
+#else
+			if (file >= 0)
+				return true;
+			// Not /tmp, which is often a tmpfs in RAM and would defeat the point
+			string path = (!directory.empty() ? directory : string("/var/tmp")) + "/SimpleCOLLADA-XXXXXX";
+			file = mkstemp(&path[0]);
+			if (file >= 0)
+				unlink(path.c_str()); // Removed once it's closed
+			fileFailed = file < 0;
+#endif
+			return !fileFailed;
+		}
+		// Maps region, which is already in the file. The offsets are multiples of MIN_SPILL_SIZE, as mapping needs.
+		void* mapRegion(const Region& region) {
+#ifdef _WIN32
+			unsigned long long end = fileSize; // The mapping grows the file to its size
+			HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, (DWORD)(end >> 32), (DWORD)(end & 0xFFFFFFFF), NULL);
+			void* memory = EXISTS(mapping) ? MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 
+				(DWORD)((unsigned long long)region.offset >> 32), (DWORD)(region.offset & 0xFFFFFFFF), region.size) : NULL;
+			if (EXISTS(mapping))
+				CloseHandle(mapping); // The view keeps the mapping alive
+			return memory;
+#else
+			void* memory = mmap(NULL, region.size, PROT_READ | PROT_WRITE, MAP_SHARED, file, (off_t)region.offset);
+			return memory != MAP_FAILED ? memory : NULL;
+#endif
+		}
+		static void unmapRegion(void* memory, const Region& region) {
+#ifdef _WIN32
+			(void)region;
+			UnmapViewOfFile(memory);
+#else
+			munmap(memory, region.size);
+#endif
+		}
+		// Takes the first free region that fits, or grows the file by size. Called with mappedMutex held.
+		void* mapFile(size_t size) {
+			if (!openFile())
+				return NULL;
+			Region region = { fileSize, (size + MIN_SPILL_SIZE - 1) / MIN_SPILL_SIZE * MIN_SPILL_SIZE };
+			auto it = freeRegions.begin();
+			while (it != freeRegions.end() && it->second < region.size)
+				++it;
+			if (it != freeRegions.end()) {
+				region.offset = it->first;
+				size_t left = it->second - region.size;
+				freeRegions.erase(it);
+				if (left > 0)
+					freeRegions[region.offset + region.size] = left;
+			} else {
+#ifndef _WIN32
+				if (ftruncate(file, (off_t)(fileSize + region.size)) != 0)
+					return NULL;
+#endif
+				fileSize += region.size;
+			}
+			void* memory = mapRegion(region);
+			if (EXISTS(memory))
+				mapped[memory] = region;
+			else
+				freeRegion(region);
+			return memory;
+		}
+		// Merges region with the free ones next to it. Off the end of the file, it's cut off instead, 
+		// except on Windows, which can't shrink a file that has views.
+		void freeRegion(Region region) {
+			auto next = freeRegions.find(region.offset + region.size);
+			if (next != freeRegions.end()) {
+				region.size += next->second;
+				freeRegions.erase(next);
+			}
+			auto previous = freeRegions.lower_bound(region.offset);
+			if (previous != freeRegions.begin() && (--previous)->first + previous->second == region.offset) {
+				region.offset = previous->first;
+				region.size += previous->second;
+				freeRegions.erase(previous);
+			}
+#ifndef _WIN32
+			if (region.offset + region.size == fileSize && ftruncate(file, (off_t)region.offset) == 0) {
+				fileSize = region.offset;
+				return;
+			}
+#endif
+			freeRegions[region.offset] = region.size;
+		}
+
+		static void* spillAllocate(size_t size, void* user) {
+			SpillAllocator* spill = (SpillAllocator*)user;
+			if (size >= MIN_SPILL_SIZE && spill->residentBytes.load(memory_order_relaxed) + size > spill->budget) {
+				lock_guard<mutex> lock(spill->mappedMutex);
+				void* memory = spill->mapFile(size);
+				if (EXISTS(memory)) {
+					spill->mappedBytes.fetch_add(size, memory_order_relaxed);
+					return memory;
+				}
+				if (!spill->warned) {
+					ERROR_MSG("Could not make or grow the temporary file to spill to, so the geometry is staying in memory");
+					spill->warned = true;
+				}
+			}
+			void* memory = spill->hooks.alloc(size);
+			spill->residentBytes.fetch_add(size, memory_order_relaxed);
+			return memory;
+		}
+		static void spillDeallocate(void* memory, size_t size, void* user) {
+			SpillAllocator* spill = (SpillAllocator*)user;
+			if (size >= MIN_SPILL_SIZE) {
+				lock_guard<mutex> lock(spill->mappedMutex);
+				auto it = spill->mapped.find(memory);
+				if (it != spill->mapped.end()) {
+					unmapRegion(memory, it->second);
+					spill->freeRegion(it->second);
+					spill->mappedBytes.fetch_sub(size, memory_order_relaxed);
+					spill->mapped.erase(it);
+					return;
+				}
+			}
+			spill->residentBytes.fetch_sub(size, memory_order_relaxed);
+			spill->hooks.release(memory, size);
+		}
+	public:
+		static const size_t MIN_SPILL_SIZE = 64 * 1024;
+
+		// directory is where the temporary file goes. Empty uses /var/tmp, or GetTempPath on Windows.
+		SpillAllocator(size_t budget, const string& directory = "", const AllocatorHooks& hooks = AllocatorHooks()) 
+			: hooks(hooks), budget(budget), directory(directory), residentBytes(0), mappedBytes(0) {}
+		~SpillAllocator() { // destructor. Everything allocated through it has to be freed first.
+			for (auto it = mapped.begin(); it != mapped.end(); ++it)
+				unmapRegion(it->first, it->second);
+#ifdef _WIN32
+			if (file != INVALID_HANDLE_VALUE)
+				CloseHandle(file);
+#else
+			if (file >= 0)
+				close(file);
+#endif
+		}
+		// Hooks to allocate through. They point to this SpillAllocator, so it has to outlive what uses them.
+		AllocatorHooks allocator() {
+			AllocatorHooks spilling;
+			spilling.allocate = spillAllocate;
+			spilling.deallocate = spillDeallocate;
+			spilling.user = this;
+			return spilling;
+		}
+		inline size_t getResidentBytes() const { return residentBytes; } // Allocated in memory
+		inline size_t getMappedBytes() const { return mappedBytes; } // Allocated in the temporary file
+	};
+#endif
+
+	/* 
+	 * Pass one in LoadOptions::progress to watch a load from another thread, or to stop it early. 
+	 * Cancelling is checked while reading the file, between geometries, and while decoding large arrays.
+	 */
+	class LoadProgress {
+	public:
+		atomic<size_t> bytesTotal, bytesRead; // Size of the file, and how much of it has been read
+		atomic<bool> documentParsed; // The XML has been parsed, and geometries are being decoded
+		atomic<size_t> geometriesTotal, geometriesDone; // Instanced geometries in the scene
+		atomic<bool> cancelRequested;
+		LoadProgress() : bytesTotal(0), bytesRead(0), documentParsed(false), geometriesTotal(0), geometriesDone(0), cancelRequested(false) {}
+		inline void cancel() { cancelRequested = true; }
+		inline bool isCancelled() const { return cancelRequested.load(memory_order_relaxed); }
+	};
+
+	class ModelVisitor;
+	class ParserContext;
+	class Tracer;
+
+	typedef struct _LoadOptions {
+		bool generateNormals = false; // Generate normals for triangle groups that don't have any
+		NORMAL_WEIGHTING normalWeighting = AREA_WEIGHTED;
+		float creaseAngle = 180.0f; // Degrees. Faces meeting at a sharper angle than this won't share normals.
+		// Threads generateNormals can split a large triangle group between. 1 keeps it on the loading thread, and 0 is one per core.
+		unsigned normalThreads = 1;
+		// Name of a vertex color group to merge into the alpha of the first group, instead of storing it.
+		// A color that's shared by corners with different alphas gets the last one's.
+		string alphaGroup;
+		// Only decode a ModelNode's geometry the first time it's accessed. The Model keeps the file in memory. 
+		// Threads can share nodes that haven't been decoded yet: the first one to use a node decodes it, and the others wait.
+		bool lazyDecoding = false;
+		// Only load part of the scene. Empty lists match everything, and patterns can use the * and ? wildcards.
+		vector<string> nodeNames; // Names (or ids) of scene <node>s. Everything under a matching node gets loaded.
+		vector<string> geometryIds; // Ids (or names) of <geometry>s
+		vector<string> materialNames; // Triangle groups using other materials (or none) are skipped
+		ModelVisitor* visitor = NULL; // Streams the geometry to this instead of storing it in the Model's modelNodes
+		size_t visitorBatchSize = 4096; // Most elements sent in one call to the visitor. 0 counts as 1.
+		LoadProgress* progress = NULL; // Only used while the Model is being constructed
+		ParserContext* context = NULL; // Reuses its memory from load to load
+		Tracer* tracer = NULL; // Records the load's timeline. Can be shared by loads on different threads.
+		AllocatorHooks allocator; // Memory for the document's pool, the file's buffer and the ModelNodes' arrays
+		size_t initialPoolSize = 0; // Bytes of document pool to set aside before parsing, on top of RAPIDXML_STATIC_POOL_SIZE
+#ifdef SIMPLECOLLADA_ENABLE_SPILL
+		// Most bytes of ModelNode arrays to keep in memory. Arrays past it go in temporary files (see SpillAllocator). 0 is no limit.
+		size_t memoryBudget = 0;
+		string spillDirectory; // Where the temporary files go. Empty uses /var/tmp, or the system's temporary directory on Windows.
+#endif
+	} LoadOptions;
+
 	typedef struct _Triangle {
 		long position[3] = { -1, -1, -1 },
 			normal[3] = { -1, -1, -1 },
@@ -70,8 +397,8 @@ namespace SimpleCOLLADA {
 		float transparency = 1.0;
 		u32 color = 0xFFFFFFFF;
 	public:
-		inline string getName() { return name; };
-		inline string getFileName() { return filename; };
+		inline const string& getName() { return name; };
+		inline const string& getFileName() { return filename; };
 		inline float getTransparency() { return transparency; };
 		inline u32 getColor() { return color; };
 		inline void setName(string n) { name = n; };
@@ -80,169 +407,1158 @@ namespace SimpleCOLLADA {
 		inline void setColor(u32 col) { color = col; };
 	};
 
+	/* 
+	 * What Model::probe() finds out about a file without decoding any geometry. The counts are for everything 
+	 * in library_geometries, so a geometry that is instanced more than once is only counted once.
+	 */
+	typedef struct _ModelInfo {
+		UP_AXIS upAxis = NO_FIND;
+		string unitName = "meter";
+		float unitMeter = 1.0f;
+		size_t numOfGeometries = 0;
+		size_t numOfPrimitives = 0; // <triangles> and triangulated <polylist> elements
+		size_t numOfTriangles = 0;
+		size_t numOfUntriangulatedPrimitives = 0; // <polylist>s with polygons that aren't triangles, which the loader skips
+		size_t numOfGeometryInstances = 0; // <instance_geometry> elements. Each one is decoded separately.
+		// What the triangle groups' inputs point to, counted once for every group that uses them (like the loader decodes them)
+		size_t numOfPositions = 0, numOfNormals = 0, numOfTexCoords = 0, numOfColors = 0;
+		size_t numOfTexCoordSets = 0, numOfColorGroups = 0; // Added up over the triangle groups
+		size_t numOfExtraIndices = 0; // For uv sets after the first and color groups after the first, 3 per triangle
+		// The size of what the loader parses
+		size_t fileSize = 0;
+		size_t numOfXmlNodes = 0; // Elements, plus the text of the ones that have any
+		size_t numOfXmlAttributes = 0;
+		size_t numOfIds = 0;
+		vector<string> materialNames;
+		vector<string> textureFileNames;
+	} ModelInfo;
+
+	/* 
+	 * Bytes of memory used, from ModelNode::memoryUsage(), Model::memoryUsage() or Model::estimateMemoryUsage().
+	 * Arrays count their capacity. Hash tables are estimated from their bucket and element counts.
+	 */
+	typedef struct _MemoryUsage {
+		size_t attributes = 0; // Vertices, normals and texture coordinates
+		size_t indices = 0; // Triangles, and the extra index lists for uv sets and color groups
+		size_t colorGroups = 0; // Vertex colors and the groups' names
+		size_t materials = 0;
+		size_t nodes = 0; // The Model and ModelNode objects and their bookkeeping
+		size_t parser = 0; // The file's buffer, the XML document and the lookup tables. Freed after loading, unless decoding is lazy.
+		size_t spilled = 0; // How much of the attributes and indices is in temporary files (LoadOptions::memoryBudget). Not added to total(). Always 0 without SIMPLECOLLADA_ENABLE_SPILL.
+		inline size_t total() const { return attributes + indices + colorGroups + materials + nodes + parser; }
+		inline void add(const _MemoryUsage& other) {
+			attributes += other.attributes;
+			indices += other.indices;
+			colorGroups += other.colorGroups;
+			materials += other.materials;
+			nodes += other.nodes;
+			parser += other.parser;
+			spilled += other.spilled;
+		}
+		template<typename Map>
+		static size_t hashMapBytes(const Map& map) { // Bucket array, plus a node per element holding the element and a next pointer
+			return map.bucket_count() * sizeof(void*) + map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void*));
+		}
+	} MemoryUsage;
+
+	/* 
+	 * Where a load's time and memory went, from Model::getStats(). It's only filled in when SIMPLECOLLADA_ENABLE_STATS 
+	 * is defined before including SimpleCOLLADA.hpp, and otherwise the counting compiles away and it's all zeros.
+	 * Decoding and materials are part of the scene's time. Lazily decoded nodes add to the scene, decode and counts 
+	 * when they get decoded, and the times of nodes decoded by several ModelBatchLoader workers are added up.
+	 */
+	typedef struct _LoadStats {
+		double readMilliseconds = 0; // Reading the file
+		double parseMilliseconds = 0; // rapidxml's parse
+		double indexMilliseconds = 0; // Indexing every id in the document
+		double sceneMilliseconds = 0; // Finding the scene's geometry and building the ModelNodes
+		double decodeMilliseconds = 0; // Turning the text of the float and index arrays into the ModelNodes' elements
+		double materialMilliseconds = 0; // Resolving materials and their effects
+		double totalMilliseconds = 0; // The whole load
+		size_t bytesRead = 0;
+		size_t elementsVisited = 0; // XML elements walked while indexing ids and finding the scene's geometry
+		size_t floatsDecoded = 0;
+		size_t indicesDecoded = 0;
+		// Hooked allocations: only the memory that goes through LoadOptions::allocator (see AllocatorHooks for what that covers). 
+		// The ModelNodes' arrays, plus the XML pool, file buffer and lookup tables unless LoadOptions::context is set.
+		size_t hookedAllocations = 0;
+		size_t hookedPeakBytes = 0; // Most of it held at once
+		size_t hookedCurrentBytes = 0; // Still held
+
+		// Writes it as one line of JSON, for collecting runs and comparing them over time
+		void write(ostream& out) const {
+			out << "{\"readMilliseconds\":" << readMilliseconds << ",\"parseMilliseconds\":" << parseMilliseconds 
+				<< ",\"indexMilliseconds\":" << indexMilliseconds << ",\"sceneMilliseconds\":" << sceneMilliseconds 
+				<< ",\"decodeMilliseconds\":" << decodeMilliseconds << ",\"materialMilliseconds\":" << materialMilliseconds 
+				<< ",\"totalMilliseconds\":" << totalMilliseconds << ",\"bytesRead\":" << bytesRead 
+				<< ",\"elementsVisited\":" << elementsVisited << ",\"floatsDecoded\":" << floatsDecoded 
+				<< ",\"indicesDecoded\":" << indicesDecoded << ",\"hookedAllocations\":" << hookedAllocations 
+				<< ",\"hookedPeakBytes\":" << hookedPeakBytes << ",\"hookedCurrentBytes\":" << hookedCurrentBytes << "}" << endl;
+		}
+	} LoadStats;
+
+	/* 
+	 * Set LoadOptions::visitor to get the geometry pushed to you while the file is parsed, instead of it being stored 
+	 * in the Model. The arrays are decoded a batch of at most LoadOptions::visitorBatchSize elements at a time, and 
+	 * each batch is sent before the next one is decoded, so only a batch is held in memory. The exceptions are 
+	 * LoadOptions::alphaGroup, which keeps one alpha per color of the group it's folded into, and 
+	 * LoadOptions::generateNormals, which decodes a triangle group without normals whole before sending it.
+	 * The pointers are only valid during the call.
+	 * For each triangle group: onPrimitiveBegin, the vertex data, the triangles, the extra index lists, then onPrimitiveEnd.
+	 */
+	class ModelVisitor {
+	public:
+		virtual ~ModelVisitor() {}
+		virtual void onMaterial(Material* /*material*/) {} // The first time a material is used. It belongs to the Model.
+		virtual void onPrimitiveBegin(const char* /*geometryId*/, Material* /*material*/, size_t /*numOfTriangles*/) {}
+		virtual void onVertexBatch(const Vertex* /*vertices*/, size_t /*count*/) {}
+		virtual void onNormalBatch(const Normal* /*normals*/, size_t /*count*/) {}
+		virtual void onTexCoordBatch(size_t /*setIndex*/, const TextureCoord* /*texCoords*/, size_t /*count*/) {} // Numbered like ModelNode's sets
+		virtual void onVertexColorBatch(const string& /*group*/, const VertexColor* /*colors*/, size_t /*count*/) {} // The group Triangle::color uses comes first
+		virtual void onTriangleBatch(const Triangle* /*triangles*/, size_t /*count*/) {}
+		// 3 indices per triangle for uv sets after set 0, and for color groups after the first one
+		virtual void onTexCoordIndexBatch(size_t /*setIndex*/, const long* /*indices*/, size_t /*count*/) {}
+		virtual void onVertexColorIndexBatch(const string& /*group*/, const long* /*indices*/, size_t /*count*/) {}
+		virtual void onPrimitiveEnd() {}
+	};
+
+	class Model;
+
 	class ModelNode {
 	private:
-		vector<Triangle*> triangles;
-		vector<Vertex*> vertices;
-		vector<TextureCoord*> texuvs;
-		vector<Normal*> normals;
-		unordered_map<string, vector<VertexColor*>> vertexColorMap;
-		Material* material;
+		AllocatorHooks hooks; // Where the arrays below get their memory from
+		HookVector<Triangle> triangles;
+		HookVector<Vertex> vertices;
+		/* 
+		 * Texture coordinate sets are numbered from 0 in the order they're stored, which isn't always their COLLADA 
+		 * set attribute: inputs with set="0" and set="2" become sets 0 and 1. texCoordSetNumbers has the attributes.
+		 */
+		vector<HookVector<TextureCoord>> texCoordSets; // Set 0 is indexed by Triangle::uv
+		vector<int> texCoordSetNumbers;
+		vector<HookVector<long>> texCoordSetIndices; // 3 indices per triangle for every set after set 0
+		HookVector<Normal> normals;
+		typedef struct _VertexColorGroup {
+			string name;
+			HookVector<VertexColor> colors;
+			HookVector<long> indices; // 3 indices per triangle, empty for the first group (Triangle::color)
+			_VertexColorGroup(const AllocatorHooks& hooks) : colors(HookAllocator<VertexColor>(hooks)), indices(HookAllocator<long>(hooks)) {}
+		} VertexColorGroup;
+		vector<VertexColorGroup> vertexColorGroups;
+		unordered_map<string, int> vertexColorGroupIds;
+		int firstVertexColorGroup = NOT_FOUND; // Indexed by Triangle::color
+		Material* material = NULL;
+		friend class ModelBatchLoader;
+
+		// Set when the geometry is decoded the first time it's used (LoadOptions::lazyDecoding). decodeMutex guards pendingPrimitive, 
+		// so threads sharing the node wait for whichever one decodes it. It's recursive since decoding goes through the accessors.
+		Model* owner = NULL;
+		xml_node<>* pendingPrimitive = NULL;
+		size_t pendingTriangleCount = 0;
+		atomic<bool> decoded;
+		recursive_mutex decodeMutex;
+		void decode();
+		inline void ensureDecoded() { if (!decoded.load(memory_order_acquire)) decode(); }
+		friend class Model;
+		inline HookVector<TextureCoord>& texCoords(size_t set) {
+			if (set >= texCoordSets.size()) texCoordSets.resize(set + 1, HookVector<TextureCoord>(HookAllocator<TextureCoord>(hooks)));
+			return texCoordSets[set];
+		}
+		// Swapping vectors is only allowed when their allocators are equal, since HookAllocator doesn't propagate on swap
+		static inline void takeIndices(HookVector<long>& dest, HookVector<long>& indices) {
+			if (dest.get_allocator() == indices.get_allocator()) dest.swap(indices);
+			else dest.assign(indices.begin(), indices.end());
+		}
+		inline HookVector<long>& texCoordIndices(size_t set) {
+			if (set >= texCoordSetIndices.size()) texCoordSetIndices.resize(set + 1, HookVector<long>(HookAllocator<long>(hooks)));
+			return texCoordSetIndices[set];
+		}
 	public:
-		inline void addTriangle(Triangle* tri) { triangles.push_back(tri); }
-		inline void addVertex(Vertex* vert) { vertices.push_back(vert); }
-		inline void addTextureCoord(TextureCoord* tc) { texuvs.push_back(tc); }
-		inline void addVertexColor(VertexColor* vc, string group) { vertexColorMap[group].push_back(vc); }
-		inline void addNormal(Normal* nrm) { normals.push_back(nrm); }
+		ModelNode() : decoded(true) {}
+		// The geometry arrays get their memory from hooks
+		ModelNode(const AllocatorHooks& hooks) : hooks(hooks), triangles(HookAllocator<Triangle>(hooks)), 
+			vertices(HookAllocator<Vertex>(hooks)), normals(HookAllocator<Normal>(hooks)), decoded(true) {}
+
+		inline bool isDecoded() { return decoded.load(memory_order_acquire); }
+		// The pointer versions take ownership, and the element gets copied into the node's array
+		inline void addTriangle(const Triangle& tri) { triangles.push_back(tri); }
+		inline void addTriangle(Triangle* tri) { addTriangle(*tri); delete tri; }
+		inline void addVertex(const Vertex& vert) { vertices.push_back(vert); }
+		inline void addVertex(Vertex* vert) { addVertex(*vert); delete vert; }
+		// setIndex is the set's place in the node (see getTexCoordSetIndex), not its COLLADA set attribute
+		inline void addTextureCoord(const TextureCoord& tc, size_t setIndex = 0) { texCoords(setIndex).push_back(tc); }
+		inline void addTextureCoord(TextureCoord* tc) { addTextureCoord(tc, 0); }
+		inline void addTextureCoord(TextureCoord* tc, size_t setIndex) { addTextureCoord(*tc, setIndex); delete tc; }
+		inline void setTexCoordIndices(size_t setIndex, vector<long>& indices) { texCoordIndices(setIndex).assign(indices.begin(), indices.end()); }
+		// Takes indices' memory when it comes from the same hooks as the node's, and copies it otherwise
+		inline void setTexCoordIndices(size_t setIndex, HookVector<long>& indices) { takeIndices(texCoordIndices(setIndex), indices); }
+		inline int addVertexColorGroup(const string& group) {
+			auto it = vertexColorGroupIds.find(group);
+			if (it != vertexColorGroupIds.end()) return it->second;
+			VertexColorGroup newGroup(hooks);
+			newGroup.name = group;
+			vertexColorGroups.push_back(newGroup);
+			vertexColorGroupIds[group] = (int)vertexColorGroups.size() - 1;
+			return (int)vertexColorGroups.size() - 1;
+		}
+		inline void addVertexColor(const VertexColor& vc, int groupId) { vertexColorGroups[groupId].colors.push_back(vc); }
+		inline void addVertexColor(VertexColor* vc, string group) { // Takes ownership of vc
+			addVertexColor(*vc, addVertexColorGroup(group));
+			delete vc;
+		}
+		inline void setVertexColorIndices(int groupId, vector<long>& indices) { vertexColorGroups[groupId].indices.assign(indices.begin(), indices.end()); }
+		inline void setVertexColorIndices(int groupId, HookVector<long>& indices) { takeIndices(vertexColorGroups[groupId].indices, indices); }
+		inline void setFirstVertexColorGroup(int groupId) { firstVertexColorGroup = groupId; }
+		inline void addNormal(const Normal& nrm) { normals.push_back(nrm); }
+		inline void addNormal(Normal* nrm) { addNormal(*nrm); delete nrm; }
 		inline void resizeNormals(size_t newSize) { normals.resize(newSize); }
 		inline void setMaterial(Material* mat) { material = mat; }
-		inline Triangle* getTriangle(int index) { return triangles[index]; }
-		inline Vertex* getVertex(int index) { return vertices[index]; }
-		inline TextureCoord* getTextureCoord(int index) { return texuvs[index]; }
-		inline Normal* getNormal(int index) { return normals[index]; }
-		inline VertexColor* getVertexColor(string group, int index) { 
-			if(vertexColorMap.find(group) != vertexColorMap.end())
-				if(index < vertexColorMap[group].size())
-					return vertexColorMap[group][index];
+		// The arrays are contiguous, so these pointers change when more elements get added
+		inline Triangle* getTriangle(int index) { ensureDecoded(); return &triangles[index]; }
+		inline Vertex* getVertex(int index) { ensureDecoded(); return &vertices[index]; }
+		inline TextureCoord* getTextureCoord(int index) { ensureDecoded(); return &texCoordSets[0][index]; }
+		inline TextureCoord* getTextureCoord(size_t setIndex, int index) { ensureDecoded(); return &texCoordSets[setIndex][index]; }
+		inline long getTexCoordIndex(size_t setIndex, int triangle, int corner) {
+			ensureDecoded();
+			if (setIndex == 0) return triangles[triangle].uv[corner];
+			if (setIndex < texCoordSetIndices.size() && (size_t)(triangle * 3 + corner) < texCoordSetIndices[setIndex].size())
+				return texCoordSetIndices[setIndex][triangle * 3 + corner];
+			return -1;
+		}
+		// Where the input with this COLLADA set attribute is stored, or NOT_FOUND
+		inline int getTexCoordSetIndex(int colladaSet) {
+			ensureDecoded();
+			for (size_t i = 0; i < texCoordSetNumbers.size(); i++)
+				if (texCoordSetNumbers[i] == colladaSet) return (int)i;
+			return NOT_FOUND;
+		}
+		// The COLLADA set attribute of a stored set (0 for inputs without one), or NOT_FOUND
+		inline int getTexCoordSetNumber(size_t setIndex) { ensureDecoded(); return setIndex < texCoordSetNumbers.size() ? texCoordSetNumbers[setIndex] : NOT_FOUND; }
+		inline long getVertexColorIndex(int groupId, int triangle, int corner) {
+			ensureDecoded();
+			if (groupId == firstVertexColorGroup) return triangles[triangle].color[corner];
+			if (groupId >= 0 && (size_t)groupId < vertexColorGroups.size() && (size_t)(triangle * 3 + corner) < vertexColorGroups[groupId].indices.size())
+				return vertexColorGroups[groupId].indices[triangle * 3 + corner];
+			return -1;
+		}
+		inline long getVertexColorIndex(const string& group, int triangle, int corner) { 
+			return getVertexColorIndex(getVertexColorGroupId(group), triangle, corner); 
+		}
+		inline Normal* getNormal(int index) { ensureDecoded(); return &normals[index]; }
+
+		/* 
+		 * Vertex color groups can be looked up by name, or by the id that getVertexColorGroupId() returns. Ids 
+		 * go from 0 to getNumOfVertexColorGroups()-1, so use them instead of names when looping over lots of colors.
+		 */
+		inline int getVertexColorGroupId(const string& group) {
+			ensureDecoded();
+			auto it = vertexColorGroupIds.find(group);
+			return it != vertexColorGroupIds.end() ? it->second : NOT_FOUND;
+		}
+		inline string getVertexColorGroupName(int groupId) {
+			ensureDecoded();
+			return groupId >= 0 && (size_t)groupId < vertexColorGroups.size() ? vertexColorGroups[groupId].name : "";
+		}
+		inline VertexColor* getVertexColor(int groupId, int index) {
+			ensureDecoded();
+			if (groupId >= 0 && (size_t)groupId < vertexColorGroups.size() && (size_t)index < vertexColorGroups[groupId].colors.size())
+				return &vertexColorGroups[groupId].colors[index];
+			return NULL;
+		}
+		inline VertexColor* getVertexColor(const string& group, int index) { return getVertexColor(getVertexColorGroupId(group), index); }
+		inline VertexColor* getVertexColors(int groupId) { // getNumOfVertexColors(groupId) long, NULL for a group that doesn't exist
+			ensureDecoded();
+			if (groupId >= 0 && (size_t)groupId < vertexColorGroups.size())
+				return vertexColorGroups[groupId].colors.data();
+			return NULL;
+		}
+		inline const long* getVertexColorIndices(int groupId) { // 3 per triangle, NULL for the group in Triangle::color
+			ensureDecoded();
+			if (groupId >= 0 && (size_t)groupId < vertexColorGroups.size() && !vertexColorGroups[groupId].indices.empty())
+				return vertexColorGroups[groupId].indices.data();
 			return NULL;
 		}
 		inline Material* getMaterial() { return material; }
-		inline size_t getNumOfTriangles() { return triangles.size(); };
-		inline size_t getNumOfVertices() { return vertices.size(); };
-		inline size_t getNumOfTexCoords() { return texuvs.size(); };
-		inline size_t getNumOfNormals() { return normals.size(); };
-		inline size_t getNumOfVertexColorGroups() { return vertexColorMap.size(); };
-		inline size_t getNumOfVertexColors(string group) { return vertexColorMap[group].size(); };
+		inline size_t getNumOfTriangles() {
+			if (!decoded.load(memory_order_acquire)) { // The count the file gives, without decoding it
+				lock_guard<recursive_mutex> lock(decodeMutex);
+				if (EXISTS(pendingPrimitive)) return pendingTriangleCount;
+			}
+			return triangles.size();
+		};
+		inline size_t getNumOfVertices() { ensureDecoded(); return vertices.size(); };
+		inline size_t getNumOfTexCoords() { return getNumOfTexCoords(0); };
+		inline size_t getNumOfTexCoords(size_t setIndex) { ensureDecoded(); return setIndex < texCoordSets.size() ? texCoordSets[setIndex].size() : 0; };
+		inline size_t getNumOfTexCoordSets() { ensureDecoded(); return texCoordSets.size(); };
+		inline size_t getNumOfNormals() { ensureDecoded(); return normals.size(); };
+		inline size_t getNumOfVertexColorGroups() { ensureDecoded(); return vertexColorGroups.size(); };
+		inline size_t getNumOfVertexColors(int groupId) { 
+			ensureDecoded();
+			return groupId >= 0 && (size_t)groupId < vertexColorGroups.size() ? vertexColorGroups[groupId].colors.size() : 0; 
+		};
+		inline size_t getNumOfVertexColors(const string& group) { return getNumOfVertexColors(getVertexColorGroupId(group)); };
 		inline string getFirstVertexColorGroupName() {
-			if(vertexColorMap.size() > 0) return vertexColorMap.begin()->first;
+			ensureDecoded();
+			if(firstVertexColorGroup != NOT_FOUND) return vertexColorGroups[firstVertexColorGroup].name;
+			if(vertexColorGroups.size() > 0) return vertexColorGroups[0].name;
 			else return "";
 		}
-		inline vector<string> getVertexColorGroupNames() { 
+		inline vector<string> getVertexColorGroupNames() {
+			ensureDecoded();
 			vector<string> keys;
-			for (auto it = vertexColorMap.begin(); it != vertexColorMap.end(); ++it)
-				keys.push_back(it->first);
+			for (size_t i = 0; i < vertexColorGroups.size(); i++)
+				keys.push_back(vertexColorGroups[i].name);
 			return keys;
 		};
-		inline ~ModelNode() { // destructor
-			for (size_t i = 0; i < triangles.size(); i++) delete triangles[i];
-			for (size_t i = 0; i < vertices.size(); i++) delete vertices[i];
-			for (size_t i = 0; i < texuvs.size(); i++) delete texuvs[i];
-			for (size_t i = 0; i < normals.size(); i++) delete normals[i];
-			for (auto it = vertexColorMap.begin(); it != vertexColorMap.end(); ++it)
-				for (size_t i = 0; i < it->second.size(); i++) 
-					delete it->second[i];
+
+		// What this node's geometry takes up. A node that hasn't been decoded yet (LoadOptions::lazyDecoding) isn't decoded by this.
+		MemoryUsage memoryUsage() {
+			MemoryUsage usage;
+			usage.attributes = vertices.capacity() * sizeof(Vertex) + normals.capacity() * sizeof(Normal);
+			for (size_t i = 0; i < texCoordSets.size(); i++)
+				usage.attributes += texCoordSets[i].capacity() * sizeof(TextureCoord);
+			usage.indices = triangles.capacity() * sizeof(Triangle);
+			for (size_t i = 0; i < texCoordSetIndices.size(); i++)
+				usage.indices += texCoordSetIndices[i].capacity() * sizeof(long);
+			for (size_t i = 0; i < vertexColorGroups.size(); i++) {
+				usage.colorGroups += vertexColorGroups[i].colors.capacity() * sizeof(VertexColor) + vertexColorGroups[i].name.capacity();
+				usage.indices += vertexColorGroups[i].indices.capacity() * sizeof(long);
+			}
+			usage.colorGroups += MemoryUsage::hashMapBytes(vertexColorGroupIds);
+			usage.nodes = sizeof(ModelNode) + texCoordSets.capacity() * sizeof(HookVector<TextureCoord>) 
+				+ texCoordSetIndices.capacity() * sizeof(HookVector<long>) + texCoordSetNumbers.capacity() * sizeof(int)
+				+ vertexColorGroups.capacity() * sizeof(VertexColorGroup);
+			return usage;
 		}
-	};
 
-	class Model {
 	private:
-		unordered_map<string, xml_node<>*> lib_visuals;
-		unordered_map<string, xml_node<>*> lib_geometries;
-		unordered_map<string, xml_node<>*> lib_materials;
-		unordered_map<string, xml_node<>*> lib_effects;
-		unordered_map<string, xml_node<>*> lib_images;
-		unordered_map<string, xml_node<>*> materialSymbolTargetMap;
+		// Runs work(begin, end) on ranges of [0, count), on up to threadCount threads (0 is one per core). 
+		// A threadCount of 1, or fewer than 2 * MIN_PER_THREAD elements, runs it all on this thread without starting any.
+		static void parallelFor(size_t count, unsigned threadCount, const function<void(size_t, size_t)>& work) {
+			const size_t MIN_PER_THREAD = 16384;
+			size_t chunks = 1;
+			if (threadCount != 1 && count >= 2 * MIN_PER_THREAD) {
+				if (threadCount == 0) threadCount = thread::hardware_concurrency();
+				chunks = count / MIN_PER_THREAD < threadCount ? count / MIN_PER_THREAD : threadCount;
+			}
+			if (chunks <= 1) {
+				work(0, count);
+				return;
+			}
+			vector<thread> threads;
+			for (size_t i = 1; i < chunks; i++)
+				threads.push_back(thread(work, count * i / chunks, count * (i + 1) / chunks));
+			work(0, count / chunks);
+			for (size_t i = 0; i < threads.size(); i++)
+				threads[i].join();
+		}
+		static inline bool normalLess(const Normal& a, const Normal& b) {
+			return a.nx != b.nx ? a.nx < b.nx : (a.ny != b.ny ? a.ny < b.ny : a.nz < b.nz);
+		}
+		static inline bool normalEquals(const Normal& a, const Normal& b) { return a.nx == b.nx && a.ny == b.ny && a.nz == b.nz; }
+
+	public:
+		/* 
+		 * Replaces the normals with smooth ones computed from the triangles. Every corner that shares a 
+		 * position gets the same normal, unless the faces meet at an angle sharper than creaseAngle (degrees).
+		 * Nodes with at least 32768 triangles or positions can be split between threadCount threads (0 is one per core).
+		 * The default of 1 never starts a thread.
+		 */
+		void generateNormals(NORMAL_WEIGHTING weighting = AREA_WEIGHTED, float creaseAngle = 180.0f, unsigned threadCount = 1) {
+			ensureDecoded();
+			normals.clear();
+			size_t numTris = triangles.size(), numVerts = vertices.size();
+			Triangle* tris = triangles.data();
+			const Vertex* verts = vertices.data();
+			
+			// Unit face normals, and how much each corner contributes to the normals of its position.
+			vector<Normal> faceNormals(numTris);
+			vector<float> cornerWeights(numTris * 3, 0.0f);
+			vector<u8> validTris(numTris, 0); // Not vector<bool>, which threads can't write next to each other in
+			parallelFor(numTris, threadCount, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++) {
+					long* pos = tris[i].position;
+					tris[i].normal[0] = tris[i].normal[1] = tris[i].normal[2] = -1;
+					if (pos[0] < 0 || pos[1] < 0 || pos[2] < 0 || pos[0] >= (long)numVerts || pos[1] >= (long)numVerts || pos[2] >= (long)numVerts)
+						continue;
+					const Vertex *a = &verts[pos[0]], *b = &verts[pos[1]], *c = &verts[pos[2]];
+					float e1[3] = { b->x - a->x, b->y - a->y, b->z - a->z };
+					float e2[3] = { c->x - a->x, c->y - a->y, c->z - a->z };
+					float nx = e1[1] * e2[2] - e1[2] * e2[1];
+					float ny = e1[2] * e2[0] - e1[0] * e2[2];
+					float nz = e1[0] * e2[1] - e1[1] * e2[0];
+					float len = sqrt(nx * nx + ny * ny + nz * nz); // Twice the area of the triangle
+					if (!(len > 0.0f) || !isfinite(len)) 
+						continue; // Degenerate triangles don't contribute to anything
+					faceNormals[i].nx = nx / len;
+					faceNormals[i].ny = ny / len;
+					faceNormals[i].nz = nz / len;
+					validTris[i] = 1;
+					for (size_t j = 0; j < 3; j++) {
+						if (weighting == ANGLE_WEIGHTED) {
+							const Vertex *p = &verts[pos[j]], *p1 = &verts[pos[(j + 1) % 3]], *p2 = &verts[pos[(j + 2) % 3]];
+							float u[3] = { p1->x - p->x, p1->y - p->y, p1->z - p->z };
+							float v[3] = { p2->x - p->x, p2->y - p->y, p2->z - p->z };
+							float uv = sqrt((u[0] * u[0] + u[1] * u[1] + u[2] * u[2]) * (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]));
+							float cosAngle = uv > 0.0f ? (u[0] * v[0] + u[1] * v[1] + u[2] * v[2]) / uv : 1.0f;
+							cornerWeights[i * 3 + j] = acos(cosAngle < -1.0f ? -1.0f : (cosAngle > 1.0f ? 1.0f : cosAngle));
+						} else {
+							cornerWeights[i * 3 + j] = len;
+						}
+					}
+				}
+			});
 
+			// Group the corners by position.
+			vector<size_t> firstCorner(numVerts + 1, 0), corners(numTris * 3);
+			for (size_t i = 0; i < numTris; i++)
+				if (validTris[i])
+					for (size_t j = 0; j < 3; j++)
+						firstCorner[tris[i].position[j] + 1]++;
+			for (size_t i = 0; i < numVerts; i++)
+				firstCorner[i + 1] += firstCorner[i];
+			vector<size_t> fill(firstCorner.begin(), firstCorner.end() - 1);
+			for (size_t i = 0; i < numTris; i++)
+				if (validTris[i])
+					for (size_t j = 0; j < 3; j++)
+						corners[fill[tris[i].position[j]]++] = i * 3 + j;
 
-		unordered_map<string, Material*> materialIdMap;
+			/* 
+			 * Each position's distinct normals, in the order its corners first use them. They go in the position's own 
+			 * range of corner slots in slotNormals, since there are never more of them than corners, and 
+			 * slotLocal[c] is which of them slot c's corner uses. Positions don't share anything, so they're split between threads.
+			 */
+			bool smoothAll = creaseAngle >= 180.0f;
+			float cosCrease = cos(creaseAngle * 3.14159265f / 180.0f);
+			vector<Normal> slotNormals(numTris * 3);
+			vector<u32> slotLocal(numTris * 3, 0);
+			vector<size_t> firstNormal(numVerts + 1, 0);
+			parallelFor(numVerts, threadCount, [&](size_t begin, size_t end) {
+				typedef struct _face_group { // Corners of a position whose faces point the same way
+					Normal face, smooth;
+					float weight;
+					size_t first; // Its first slot
+					long local;
+				} FaceGroup;
+				vector<size_t> order;
+				vector<FaceGroup> groups;
+				vector<u32> groupOf, byFirst, bySmooth;
+				for (size_t v = begin; v < end; v++) {
+					size_t first = firstCorner[v], count = firstCorner[v + 1] - first;
+					if (count == 0) continue;
+					if (smoothAll) {
+						float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+						for (size_t c = first; c < first + count; c++) {
+							Normal& other = faceNormals[corners[c] / 3];
+							float w = cornerWeights[corners[c]];
+							nx += other.nx * w;
+							ny += other.ny * w;
+							nz += other.nz * w;
+						}
+						float len = sqrt(nx * nx + ny * ny + nz * nz);
+						Normal n = faceNormals[corners[first] / 3];
+						if (len > 0.0f && isfinite(len)) {
+							n.nx = nx / len;
+							n.ny = ny / len;
+							n.nz = nz / len;
+						}
+						slotNormals[first] = n;
+						firstNormal[v + 1] = 1;
+						continue;
+					}
 
-		vector<float> parse_float_vector(string str) {
-			vector<float> result;
-			istringstream iss(str);
-			char* pEnd;
-			for (string float_str; iss >> float_str;) {
-				result.push_back(strtof(float_str.c_str(), &pEnd));
+					// Sorting the corners by face normal finds the ones with the same face in O(n log n), and the 
+					// crease test is only done between distinct faces. A flat fan around a position is then just one of them.
+					order.resize(count);
+					for (size_t k = 0; k < count; k++) order[k] = first + k;
+					sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+						const Normal &na = faceNormals[corners[a] / 3], &nb = faceNormals[corners[b] / 3];
+						return normalEquals(na, nb) ? a < b : normalLess(na, nb);
+					});
+					groups.clear();
+					groupOf.resize(count);
+					for (size_t k = 0; k < count; k++) {
+						const Normal& face = faceNormals[corners[order[k]] / 3];
+						if (groups.empty() || !normalEquals(groups.back().face, face)) {
+							FaceGroup group;
+							group.face = face;
+							group.weight = 0.0f;
+							group.first = order[k];
+							group.local = -1;
+							groups.push_back(group);
+						}
+						groups.back().weight += cornerWeights[corners[order[k]]];
+						groupOf[order[k] - first] = (u32)(groups.size() - 1);
+					}
+					for (size_t g = 0; g < groups.size(); g++) {
+						Normal& fn = groups[g].face;
+						float nx = 0.0f, ny = 0.0f, nz = 0.0f;
+						for (size_t h = 0; h < groups.size(); h++) {
+							Normal& other = groups[h].face;
+							if (fn.nx * other.nx + fn.ny * other.ny + fn.nz * other.nz >= cosCrease) {
+								nx += other.nx * groups[h].weight;
+								ny += other.ny * groups[h].weight;
+								nz += other.nz * groups[h].weight;
+							}
+						}
+						float len = sqrt(nx * nx + ny * ny + nz * nz);
+						groups[g].smooth = fn;
+						if (len > 0.0f && isfinite(len)) {
+							groups[g].smooth.nx = nx / len;
+							groups[g].smooth.ny = ny / len;
+							groups[g].smooth.nz = nz / len;
+						}
+					}
+
+					// Groups on the same side of every crease end up with the same normal, so share it. Sorting finds them, 
+					// and each gets the number of the first corner using it.
+					bySmooth.resize(groups.size());
+					for (size_t g = 0; g < groups.size(); g++) bySmooth[g] = (u32)g;
+					sort(bySmooth.begin(), bySmooth.end(), [&](u32 a, u32 b) {
+						return normalEquals(groups[a].smooth, groups[b].smooth) ? groups[a].first < groups[b].first : normalLess(groups[a].smooth, groups[b].smooth);
+					});
+					byFirst.resize(groups.size()); // The group each group's normal is shared from
+					for (size_t k = 0; k < bySmooth.size(); k++)
+						byFirst[bySmooth[k]] = k > 0 && normalEquals(groups[bySmooth[k]].smooth, groups[bySmooth[k - 1]].smooth) ? byFirst[bySmooth[k - 1]] : bySmooth[k];
+					u32 numLocal = 0;
+					for (size_t k = 0; k < count; k++) {
+						FaceGroup& shared = groups[byFirst[groupOf[k]]];
+						if (shared.local < 0) {
+							shared.local = numLocal++;
+							slotNormals[first + shared.local] = shared.smooth;
+						}
+						slotLocal[first + k] = (u32)shared.local;
+					}
+					firstNormal[v + 1] = numLocal;
+				}
+			});
+
+			for (size_t v = 0; v < numVerts; v++)
+				firstNormal[v + 1] += firstNormal[v];
+			normals.resize(firstNormal[numVerts]);
+			Normal* out = normals.data();
+			parallelFor(numVerts, threadCount, [&](size_t begin, size_t end) {
+				for (size_t v = begin; v < end; v++) {
+					for (size_t k = 0; k < firstNormal[v + 1] - firstNormal[v]; k++)
+						out[firstNormal[v] + k] = slotNormals[firstCorner[v] + k];
+					for (size_t c = firstCorner[v]; c < firstCorner[v + 1]; c++)
+						tris[corners[c] / 3].normal[corners[c] % 3] = (long)(firstNormal[v] + slotLocal[c]);
+				}
+			});
+		}
+	};
+
+	/* 
+	 * Maps strings in the document (ids, symbols, names) to values with an open addressing hash table. The keys point 
+	 * into the document's buffer, so nothing gets copied and the only allocation is the table itself, which comes from 
+	 * the hooks it's made with. find() returns a default Value, such as NULL, for keys it doesn't have.
+	 */
+	template<typename Value>
+	class DocumentIndex {
+	private:
+		typedef struct _entry {
+			const char* key = NULL;
+			size_t keySize = 0, hash = 0;
+			Value value = Value();
+		} Entry;
+		HookVector<Entry> entries; // Size is always 0 or a power of 2
+		size_t count = 0;
+
+		static size_t hashKey(const char* key, size_t size) { // FNV-1a
+			size_t hash = 2166136261u;
+			for (size_t i = 0; i < size; i++)
+				hash = (hash ^ (u8)key[i]) * 16777619u;
+			return hash;
+		}
+
+		void grow() {
+			HookVector<Entry> old(entries.get_allocator());
+			old.swap(entries);
+			entries.resize(old.size() > 0 ? old.size() * 2 : 64);
+			for (size_t i = 0; i < old.size(); i++) {
+				if (old[i].key == NULL) continue;
+				size_t slot = old[i].hash & (entries.size() - 1);
+				while (entries[slot].key != NULL)
+					slot = (slot + 1) & (entries.size() - 1);
+				entries[slot] = old[i];
 			}
-			return result;
 		}
+	public:
+		DocumentIndex(const AllocatorHooks& hooks = AllocatorHooks()) : entries(HookAllocator<Entry>(hooks)) {}
+		// Later values replace earlier ones with the same key.
+		void insert(const char* key, size_t keySize, Value value) {
+			if ((count + 1) * 2 > entries.size()) grow(); // Keep the table at most half full
+			size_t hash = hashKey(key, keySize);
+			size_t slot = hash & (entries.size() - 1);
+			while (entries[slot].key != NULL) {
+				if (entries[slot].hash == hash && entries[slot].keySize == keySize && memcmp(entries[slot].key, key, keySize) == 0) {
+					entries[slot].value = value;
+					return;
+				}
+				slot = (slot + 1) & (entries.size() - 1);
+			}
+			entries[slot].key = key;
+			entries[slot].keySize = keySize;
+			entries[slot].hash = hash;
+			entries[slot].value = value;
+			count++;
+		}
+		Value find(const char* key, size_t keySize) const {
+			if (count == 0) return Value();
+			size_t hash = hashKey(key, keySize);
+			for (size_t slot = hash & (entries.size() - 1); entries[slot].key != NULL; slot = (slot + 1) & (entries.size() - 1))
+				if (entries[slot].hash == hash && entries[slot].keySize == keySize && memcmp(entries[slot].key, key, keySize) == 0)
+					return entries[slot].value;
+			return Value();
+		}
+		inline Value find(const char* key) const { return find(key, strlen(key)); }
+		inline size_t size() const { return count; }
+		inline size_t memoryUsage() const { return entries.capacity() * sizeof(Entry); }
+		static size_t memoryUsageFor(size_t keys) { // What the table grows to for this many keys
+			size_t slots = 64;
+			while (slots < keys * 2) slots *= 2;
+			return keys > 0 ? slots * sizeof(Entry) : 0;
+		}
+		inline void clear() { // Keeps the table's memory around
+			for (size_t i = 0; i < entries.size(); i++) entries[i] = Entry();
+			count = 0;
+		}
+	};
+	typedef DocumentIndex<xml_node<>*> IdIndex;
+
+	/* 
+	 * Holds what a load only needs while it runs: the file's buffer, the XML document and the lookup tables.
+	 * Pass the same one in LoadOptions::context to a series of loads, and each load reuses the memory the earlier 
+	 * ones warmed up. It can only be used by one load at a time, and isn't used by lazily decoded Models.
+	 */
+	class ParserContext {
+	private:
+		typedef struct _effect_record {
+			string fileName;
+			u32 color = 0xFFFFFFFF;
+			float transparency = 1.0;
+		} Effect_record;
+
+		AllocatorHooks hooks; // Used for the pool's blocks, the file's buffer and the lookup tables
+		HookString fileBuffer; // rapidxml parses this in place, so the document points into it
+		xml_document<> doc;
+		vector<char*> freeBlocks; // The document's pool blocks from earlier loads
+		size_t blockBytes = 0; // Every pool block it has allocated and not freed, in use or not
+		IdIndex idIndex; // Every id in the document
+		IdIndex sidIndex; // The sids of the effect being parsed, reused from effect to effect
+		// Like idIndex, these are keyed by text in the document. decode_primitive doesn't touch them, so nodes can be decoded in parallel.
+		IdIndex materialSymbolTargetMap;
+		DocumentIndex<Material*> materialIdMap; // Keyed by the <material> id
+		DocumentIndex<Material*> materialNameMap; // Materials with the same name are shared too
+		DocumentIndex<Effect_record*> effectCache; // Keyed by effect id, since lots of materials can share an effect
+		deque<Effect_record> effects; // What effectCache points to
+		friend class Model;
+		friend class IncrementalLoad;
+		friend class ModelPipeline;
 
-		vector<u32> parse_u32_vector(string str) {
-			vector<u32> result;
-			istringstream iss(str);
-			char* pEnd;
-			for (string u32_str; iss >> u32_str;) {
-				result.push_back(strtol(u32_str.c_str(), &pEnd, 10));
+		// rapidxml's allocator hooks are plain functions, so the context using them is tracked per thread
+		static ParserContext*& current() {
+			static thread_local ParserContext* context = NULL;
+			return context;
+		}
+		typedef struct _scope {
+			ParserContext* previous;
+			_scope(ParserContext* context) : previous(current()) { current() = context; }
+			~_scope() { current() = previous; }
+		} Scope;
+
+		static const size_t BLOCK_HEADER = 16; // Holds the block's size, and keeps the pool aligned
+		// What rapidxml asks for each time its pool runs out, unless a single node needs more
+		static const size_t POOL_BLOCK_SIZE = sizeof(char*) + 2 * RAPIDXML_ALIGNMENT - 2 + RAPIDXML_DYNAMIC_POOL_SIZE;
+		static void* allocateBlock(size_t size) {
+			ParserContext* context = current();
+			if (EXISTS(context)) {
+				for (size_t i = 0; i < context->freeBlocks.size(); i++) {
+					char* block = context->freeBlocks[i];
+					if (*(size_t*)block >= size) {
+						context->freeBlocks[i] = context->freeBlocks.back();
+						context->freeBlocks.pop_back();
+						return block + BLOCK_HEADER;
+					}
+				}
 			}
-			return result;
+			char* block = (char*)(EXISTS(context) ? context->hooks : AllocatorHooks()).alloc(BLOCK_HEADER + size);
+			*(size_t*)block = size;
+			if (EXISTS(context))
+				context->blockBytes += BLOCK_HEADER + size;
+			return block + BLOCK_HEADER;
+		}
+		static void freeBlock(void* memory) {
+			char* block = (char*)memory - BLOCK_HEADER;
+			ParserContext* context = current();
+			if (EXISTS(context))
+				context->freeBlocks.push_back(block);
+			else
+				AllocatorHooks().release(block, BLOCK_HEADER + *(size_t*)block);
 		}
 
-		xml_attribute<>* findAttribute(xml_node<>* node, string name) {
-			if (node->first_attribute() == NULL)
-				return NULL;
-			for (XML_ATTRIBUTE_FOR_LOOP(node))
-				if (string(attribute->name()) == name)
-					return attribute;
-			return NULL;
+		void reset() {
+			Scope scope(this);
+			doc.clear(); // Hands the pool's blocks back to freeBlocks
+			idIndex.clear();
+			sidIndex.clear();
+			materialSymbolTargetMap.clear();
+			materialIdMap.clear();
+			materialNameMap.clear();
+			effectCache.clear();
+			effects.clear();
+		}
+		xml_node<>* parse() {
+			reset(); // In case the last load threw
+			Scope scope(this);
+			doc.parse<0>(&fileBuffer[0]);
+			return doc.first_node();
+		}
+	public:
+		ParserContext(const AllocatorHooks& hooks = AllocatorHooks()) : hooks(hooks), fileBuffer(HookAllocator<char>(hooks)), idIndex(hooks), sidIndex(hooks), 
+			materialSymbolTargetMap(hooks), materialIdMap(hooks), materialNameMap(hooks), effectCache(hooks) {
+			doc.set_allocator(allocateBlock, freeBlock);
+		}
+		ParserContext(const ParserContext&) = delete;
+		ParserContext& operator=(const ParserContext&) = delete;
+		// Empties it for the next load, but keeps its memory
+		void clear() {
+			reset();
+			fileBuffer.clear();
 		}
+		// Sets aside pool blocks until it holds at least this many bytes, so the next parse doesn't have to allocate them
+		void reserve(size_t bytes) {
+			size_t held = 0;
+			for (size_t i = 0; i < freeBlocks.size(); i++)
+				held += *(size_t*)freeBlocks[i];
+			for (; held < bytes; held += POOL_BLOCK_SIZE) {
+				char* block = (char*)hooks.alloc(BLOCK_HEADER + POOL_BLOCK_SIZE);
+				*(size_t*)block = POOL_BLOCK_SIZE;
+				blockBytes += BLOCK_HEADER + POOL_BLOCK_SIZE;
+				freeBlocks.push_back(block);
+			}
+		}
+		// Everything it's holding, counting the XML document's static pool (RAPIDXML_STATIC_POOL_SIZE)
+		size_t memoryUsage() const {
+			size_t bytes = sizeof(ParserContext) + fileBuffer.capacity() + blockBytes + freeBlocks.capacity() * sizeof(char*) + idIndex.memoryUsage() + sidIndex.memoryUsage();
+			bytes += materialSymbolTargetMap.memoryUsage() + materialIdMap.memoryUsage() + materialNameMap.memoryUsage() + effectCache.memoryUsage();
+			for (size_t i = 0; i < effects.size(); i++)
+				bytes += sizeof(Effect_record) + effects[i].fileName.capacity();
+			return bytes;
+		}
+		// Frees the memory it's been keeping
+		void trim() {
+			reset();
+			for (size_t i = 0; i < freeBlocks.size(); i++)
+				hooks.release(freeBlocks[i], BLOCK_HEADER + *(size_t*)freeBlocks[i]);
+			vector<char*>().swap(freeBlocks);
+			blockBytes = 0;
+			HookString(HookAllocator<char>(hooks)).swap(fileBuffer);
+			idIndex = IdIndex(hooks);
+			sidIndex = IdIndex(hooks);
+			materialSymbolTargetMap = IdIndex(hooks);
+			materialIdMap = DocumentIndex<Material*>(hooks);
+			materialNameMap = DocumentIndex<Material*>(hooks);
+			effectCache = DocumentIndex<Effect_record*>(hooks);
+			deque<Effect_record>().swap(effects);
+		}
+		~ParserContext() { // destructor
+			trim();
+		}
+	};
 
-		void buildLocalIdMap(unordered_map<string, xml_node<>*> &map, xml_node<> *root, string id_pattern) {
-			xml_attribute<>* id_attr = findAttribute(root, id_pattern);
-			if (EXISTS(id_attr)) {
-				map[string(id_attr->value())] = root;
-				//cout << "Added " << string(id_attr->value()) << " to local ID Map" << endl;
+	// Hands out ParserContexts to loads that run at the same time, and keeps them warm for the next ones
+	class ParserContextPool {
+	private:
+		mutex poolMutex;
+		vector<unique_ptr<ParserContext>> contexts;
+		vector<ParserContext*> available;
+		AllocatorHooks hooks;
+	public:
+		ParserContextPool(const AllocatorHooks& hooks = AllocatorHooks()) : hooks(hooks) {}
+		ParserContext* acquire() {
+			lock_guard<mutex> lock(poolMutex);
+			if (available.empty()) {
+				contexts.push_back(unique_ptr<ParserContext>(new ParserContext(hooks)));
+				return contexts.back().get();
 			}
-			if (root->first_node() != 0) {
-				for (XML_NODE_CHILD_FOR_LOOP(root)) {
-					buildLocalIdMap(map, child, id_pattern);
-				}
+			ParserContext* context = available.back();
+			available.pop_back();
+			return context;
+		}
+		void release(ParserContext* context) {
+			context->clear();
+			lock_guard<mutex> lock(poolMutex);
+			available.push_back(context);
+		}
+	};
+
+	// Writes str as a quoted JSON string, for Tracer's and GLBExporter's output
+	inline void writeJSONString(ostream& out, const string& str) {
+		out << '"';
+		for (size_t i = 0; i < str.size(); i++) {
+			char c = str[i];
+			if (c == '"' || c == '\\') out << '\\' << c;
+			else if ((u8)c < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", (u8)c);
+				out << escaped;
 			}
+			else out << c;
 		}
+		out << '"';
+	}
 
-		typedef struct _accessor_param {
+	/* 
+	 * Records what loads spend their time on, file by file, geometry by geometry and array by array, and writes it 
+	 * as a Chrome trace that Perfetto (ui.perfetto.dev) or chrome://tracing can open. Pass the same one to any number 
+	 * of loads in LoadOptions::tracer. Each thread records into its own buffer, so after a thread's first event 
+	 * recording doesn't take any locks. Only call write() once the loads using it are done.
+	 */
+	class Tracer {
+	private:
+		typedef struct _event {
+			const char* name; // String literals
+			const char* category;
+			string detail; // What it was working on, like the file name or geometry id
+			size_t count; // How many elements it went through, if it's not 0
+			long long start, duration; // Nanoseconds, from when the Tracer was made
+		} Event;
+		typedef struct _thread_buffer {
+			size_t tid;
 			string name;
-			string type;
-		} Accessor_param;
+			vector<Event> events;
+		} ThreadBuffer;
 
-		typedef struct _mesh_source {
-			string name;
-			size_t count, stride, error = 0;
-			vector<float> float_array;
-			vector<Accessor_param> params;
-		} Mesh_source;
+		size_t id; // So a thread can find its buffer for this Tracer. Never reused, unlike addresses and thread ids.
+		chrono::steady_clock::time_point origin;
+		mutex buffersMutex; // Only taken the first time a thread records, and by write()
+		vector<unique_ptr<ThreadBuffer>> buffers;
+
+		static size_t nextId() {
+			static atomic<size_t> ids(0);
+			return ++ids;
+		}
+		// The calling thread's buffer, or a new one if it doesn't have one yet (or fresh is set)
+		ThreadBuffer* threadBuffer(bool fresh = false) {
+			static thread_local vector<pair<size_t, ThreadBuffer*>> cached; // Tracer id and buffer
+			size_t slot = 0;
+			while (slot < cached.size() && cached[slot].first != id) slot++;
+			if (slot < cached.size() && !fresh)
+				return cached[slot].second;
+			ThreadBuffer* buffer = new ThreadBuffer();
+			{
+				lock_guard<mutex> lock(buffersMutex);
+				buffers.push_back(unique_ptr<ThreadBuffer>(buffer));
+				buffer->tid = buffers.size();
+			}
+			buffer->name = "Thread " + to_string(buffer->tid);
+			if (slot < cached.size()) cached[slot].second = buffer;
+			else cached.push_back(make_pair(id, buffer));
+			return buffer;
+		}
+		inline long long now() const { return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - origin).count(); }
+		void record(const char* name, const char* category, string& detail, size_t count, long long start) {
+			Event event;
+			event.name = name;
+			event.category = category;
+			event.detail.swap(detail);
+			event.count = count;
+			event.start = start;
+			event.duration = now() - start;
+			threadBuffer()->events.push_back(std::move(event));
+		}
+	public:
+		Tracer() : id(nextId()), origin(chrono::steady_clock::now()) {}
+		Tracer(const Tracer&) = delete;
+		Tracer& operator=(const Tracer&) = delete;
+
+		// Times the code from its construction to its destruction. Does nothing if the Tracer is NULL.
+		class Scope {
+		private:
+			Tracer* tracer;
+			const char* name;
+			const char* category;
+			string detail;
+			long long start = 0;
+		public:
+			size_t count = 0; // Set before the Scope ends to record how many elements it went through
+			Scope(Tracer* tracer, const char* name, const char* category, const char* detail = NULL) : tracer(tracer), name(name), category(category) {
+				if (!EXISTS(tracer)) return;
+				if (EXISTS(detail)) this->detail = detail;
+				start = tracer->now();
+			}
+			Scope(const Scope&) = delete;
+			Scope& operator=(const Scope&) = delete;
+			~Scope() {
+				if (EXISTS(tracer)) tracer->record(name, category, detail, count, start);
+			}
+		};
+
+		// Starts a new track in the trace for the calling thread's events, with this name
+		void setThreadName(const string& name) { threadBuffer(true)->name = name; }
 
-		vector<Accessor_param> parse_accessor_params(xml_node<> *accessor) {
-			vector<Accessor_param> params;
-			for (XML_NODE_CHILD_FOR_LOOP(accessor)) {
-				if (string(child->name()) == "param") {
-					xml_attribute<>* nameAttr = findAttribute(child, "name");
-					xml_attribute<>* typeAttr = findAttribute(child, "type");
-					if (EXISTS(nameAttr) && EXISTS(typeAttr)) {
-						Accessor_param newParam;
-						newParam.name = nameAttr->value();
-						newParam.type = typeAttr->value();
-						params.push_back(newParam);
+		void write(ostream& out) {
+			lock_guard<mutex> lock(buffersMutex);
+			out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+			bool first = true;
+			for (size_t i = 0; i < buffers.size(); i++) {
+				ThreadBuffer& buffer = *buffers[i];
+				out << (first ? "" : ",") << "\n{\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer.tid << ",\"name\":\"thread_name\",\"args\":{\"name\":";
+				writeJSONString(out, buffer.name);
+				out << "}}";
+				first = false;
+				for (size_t j = 0; j < buffer.events.size(); j++) {
+					Event& event = buffer.events[j];
+					char times[64]; // Microseconds, which is what the format uses
+					snprintf(times, sizeof(times), "\"ts\":%.3f,\"dur\":%.3f", event.start / 1000.0, event.duration / 1000.0);
+					out << ",\n{\"ph\":\"X\",\"pid\":1,\"tid\":" << buffer.tid << "," << times << ",\"name\":\"" << event.name << "\",\"cat\":\"" << event.category << "\"";
+					if (!event.detail.empty() || event.count > 0) {
+						out << ",\"args\":{";
+						if (!event.detail.empty()) {
+							out << "\"detail\":";
+							writeJSONString(out, event.detail);
+						}
+						if (event.count > 0)
+							out << (event.detail.empty() ? "" : ",") << "\"count\":" << event.count;
+						out << "}";
 					}
+					out << "}";
+				}
+			}
+			out << "\n]}\n";
+		}
+		// Returns false if the file couldn't be written
+		bool write(const string& filename) {
+			ofstream outfile(filename, ios::out | ios::binary);
+			if (!outfile.is_open()) {
+				ERROR_MSG("Error: Could not open \"" << filename << "\"");
+				return false;
+			}
+			write(outfile);
+			return outfile.good();
+		}
+	};
+
+#ifdef SIMPLECOLLADA_ENABLE_STATS
+	// Adds up a Model's LoadStats. Atomic, since a ModelBatchLoader can decode one Model's nodes on several threads.
+	class LoadCounters {
+	public:
+		atomic<long long> readNanoseconds, parseNanoseconds, indexNanoseconds, sceneNanoseconds, decodeNanoseconds, materialNanoseconds, totalNanoseconds;
+		atomic<size_t> bytesRead, elementsVisited, floatsDecoded, indicesDecoded;
+		atomic<size_t> hookedAllocations, hookedCurrentBytes, hookedPeakBytes; // Only what goes through the hooks track() returns
+		AllocatorHooks hooks; // What the counting hooks pass the memory on to
+
+		LoadCounters() : readNanoseconds(0), parseNanoseconds(0), indexNanoseconds(0), sceneNanoseconds(0), decodeNanoseconds(0), 
+			materialNanoseconds(0), totalNanoseconds(0), bytesRead(0), elementsVisited(0), floatsDecoded(0), indicesDecoded(0), 
+			hookedAllocations(0), hookedCurrentBytes(0), hookedPeakBytes(0) {}
+
+		static void* countAllocate(size_t size, void* user) {
+			LoadCounters* counters = (LoadCounters*)user;
+			void* memory = counters->hooks.alloc(size);
+			counters->hookedAllocations.fetch_add(1, memory_order_relaxed);
+			size_t held = counters->hookedCurrentBytes.fetch_add(size, memory_order_relaxed) + size;
+			size_t peak = counters->hookedPeakBytes.load(memory_order_relaxed);
+			while (held > peak && !counters->hookedPeakBytes.compare_exchange_weak(peak, held, memory_order_relaxed)) {}
+			return memory;
+		}
+		static void countDeallocate(void* memory, size_t size, void* user) {
+			LoadCounters* counters = (LoadCounters*)user;
+			counters->hookedCurrentBytes.fetch_sub(size, memory_order_relaxed);
+			counters->hooks.release(memory, size);
+		}
+		// Returns hooks that count everything before passing it on to allocator
+		AllocatorHooks track(const AllocatorHooks& allocator) {
+			hooks = allocator;
+			AllocatorHooks counting;
+			counting.allocate = countAllocate;
+			counting.deallocate = countDeallocate;
+			counting.user = this;
+			return counting;
+		}
+
+		// Adds the time between its construction and destruction to a phase
+		class Timer {
+		private:
+			atomic<long long>& phase;
+			chrono::steady_clock::time_point start;
+		public:
+			Timer(atomic<long long>& phase) : phase(phase), start(chrono::steady_clock::now()) {}
+			~Timer() { phase.fetch_add(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count(), memory_order_relaxed); }
+		};
+	};
+	#define STATS_TIME(counters, phase) LoadCounters::Timer phase##Timer((counters).phase##Nanoseconds)
+	#define STATS_ADD(counters, counter, amount) (counters).counter.fetch_add(amount, memory_order_relaxed)
+#else
+	#define STATS_TIME(counters, phase)
+	#define STATS_ADD(counters, counter, amount)
+#endif
+
+	/*
+	 * The parsing primitives Model is built on. They're not part of the API, and are only here
+	 * so that benchmark/micro.cpp can time them on their own.
+	 */
+	namespace detail {
+		// Reads up to count numbers from the text at str into values, and moves str past them. Returns how many it read.
+		// The arrays are decoded straight into the ModelNodes' elements this way, without a temporary vector per array.
+		inline size_t read_floats(const char*& str, float* values, size_t count) {
+			char* end;
+			size_t read = 0;
+			for (; read < count; read++) {
+				values[read] = strtof(str, &end);
+				if (end == str) break;
+				str = end;
+			}
+			return read;
+		}
+		inline size_t read_u32s(const char*& str, u32* values, size_t count) {
+			char* end;
+			size_t read = 0;
+			for (; read < count; read++) {
+				values[read] = strtoul(str, &end, 10);
+				if (end == str) break;
+				str = end;
+			}
+			return read;
+		}
+
+		inline xml_attribute<>* findAttribute(xml_node<>* node, const char* name) {
+			return node->first_attribute(name); // rapidxml compares against the buffer directly
+		}
+
+		// Walks the tree under root (including root) without recursion, adding every node that has an id_pattern attribute.
+		// Returns how many nodes it visited.
+		inline size_t buildIdIndex(IdIndex &map, xml_node<> *root, const char* id_pattern) {
+			xml_node<>* node = root;
+			size_t visited = 0;
+			for (; EXISTS(node); visited++) {
+				xml_attribute<>* id_attr = findAttribute(node, id_pattern);
+				if (EXISTS(id_attr))
+					map.insert(id_attr->value(), id_attr->value_size(), node);
+				if (EXISTS(node->first_node())) {
+					node = node->first_node();
+					continue;
+				}
+				while (node != root && !EXISTS(node->next_sibling()))
+					node = node->parent();
+				node = node != root ? node->next_sibling() : NULL;
+			}
+			return visited;
+		}
+
+		inline bool checkPolylistIsTriangulated(xml_node<> *polylist) {
+			xml_node<> *vcount = polylist->first_node("vcount");
+			if (EXISTS(vcount)) {
+				const char* str = vcount->value();
+				char* pEnd;
+				for (u32 i = strtoul(str, &pEnd, 10); pEnd != str; i = strtoul(str, &pEnd, 10)) {
+					if (i != 3)
+						return false;
+					str = pEnd;
 				}
+				return true;
+			}
+			return false;
+		}
+	}
+
+	class Model {
+	private:
+#ifdef SIMPLECOLLADA_ENABLE_STATS
+		LoadCounters stats; // Declared first, so it outlives the ModelNodes and context that allocate through it
+#endif
+		LoadOptions options;
+#ifdef SIMPLECOLLADA_ENABLE_SPILL
+		unique_ptr<SpillAllocator> spill; // Only with LoadOptions::memoryBudget
+#endif
+		AllocatorHooks nodeAllocator; // What the ModelNodes' arrays are allocated through
+		unique_ptr<ParserContext> ownContext;
+		ParserContext* context = NULL; // Either ownContext or LoadOptions::context. NULL once the load is done with it.
+
+		// The Model keeps its document for lazy decoding, so it can't share a context
+		static ParserContext* sharedContext(const LoadOptions& loadOptions) {
+			return loadOptions.lazyDecoding && !EXISTS(loadOptions.visitor) ? NULL : loadOptions.context;
+		}
+		void useContext(ParserContext* shared) {
+			if (EXISTS(shared)) {
+				context = shared;
+			} else {
+				ownContext.reset(new ParserContext(options.allocator));
+				context = ownContext.get();
 			}
-			return params;
+			context->reserve(options.initialPoolSize);
+		}
+
+		static const size_t CANCEL_CHECK_MASK = 0xFFFF; // Large arrays check for cancelling every 65536 elements
+		inline bool loadCancelled() { return EXISTS(options.progress) && options.progress->isCancelled(); }
+
+		// Walks the tree under root (including root) without recursion, adding every node that has an id_pattern attribute.
+		void buildLocalIdMap(IdIndex &map, xml_node<> *root, const char* id_pattern) {
+			size_t visited = detail::buildIdIndex(map, root, id_pattern);
+			STATS_ADD(stats, elementsVisited, visited);
+			(void)visited; // Only counted with SIMPLECOLLADA_ENABLE_STATS
 		}
 
-		int getParamOffset(string paramName, vector<Accessor_param> params) {
-			for (size_t i = 0; i < params.size(); i++)
-				if (params[i].name == paramName) 
-					return i;
+		static const size_t MAX_SOURCE_STRIDE = 16; // Values of an element past this many are skipped
+
+		typedef struct _mesh_source {
+			size_t count = 0, stride = 0, error = 0;
+			size_t decoded = 0; // Elements read_source has decoded so far
+			const char* values = NULL; // Where the next element starts in the <float_array>'s text
+			xml_node<>* accessor = NULL;
+		} Mesh_source;
+
+		// Where the named <param> is in each of the source's elements, or NOT_FOUND
+		int getParamOffset(const char* paramName, const Mesh_source& src) {
+			size_t offset = 0;
+			for (xml_node<>* param = src.accessor->first_node("param"); EXISTS(param); param = param->next_sibling("param"), offset++) {
+				xml_attribute<>* nameAttr = detail::findAttribute(param, "name");
+				if (EXISTS(nameAttr) && strcmp(nameAttr->value(), paramName) == 0)
+					return offset < src.stride && offset < MAX_SOURCE_STRIDE ? (int)offset : NOT_FOUND;
+			}
 			return NOT_FOUND;
 		}
 
+		// Decodes up to maxCount more of the source's elements from the <float_array>'s text, calling element(values) with each one's 
+		// values (the first MAX_SOURCE_STRIDE of them). Returns how many it decoded. A cancelled load sets the source's error.
+		template<typename Element>
+		size_t read_source(Mesh_source& src, size_t maxCount, Element element) {
+			STATS_TIME(stats, decode);
+			Tracer::Scope trace(options.tracer, "float_array", "decode");
+			float values[MAX_SOURCE_STRIDE], skipped;
+			size_t kept = src.stride < MAX_SOURCE_STRIDE ? src.stride : MAX_SOURCE_STRIDE;
+			size_t decoded = 0;
+			for (; decoded < maxCount && src.decoded < src.count && !src.error; decoded++, src.decoded++) {
+				if (detail::read_floats(src.values, values, kept) < kept) {
+					src.count = src.decoded; // The array is shorter than the accessor says
+					break;
+				}
+				for (size_t k = kept; k < src.stride; k++)
+					detail::read_floats(src.values, &skipped, 1);
+				element(values);
+				if ((src.decoded & CANCEL_CHECK_MASK) == CANCEL_CHECK_MASK && loadCancelled())
+					src.error = 4;
+			}
+			STATS_ADD(stats, floatsDecoded, decoded * src.stride);
+			trace.count = decoded * src.stride;
+			return decoded;
+		}
+
 		Mesh_source parse_source(xml_node<> *source) {
 			Mesh_source mesh_source;
-			xml_attribute<>* srcNameAttr = findAttribute(source, "name");
-			if (EXISTS(srcNameAttr))
-				mesh_source.name = string(srcNameAttr->value());
 			xml_node<> *common = source->first_node("technique_common");
 			if (EXISTS(common)) {
 				xml_node<> *accessor = common->first_node("accessor");
 				if (EXISTS(accessor)) {
-					xml_attribute<>* cntAttr = findAttribute(accessor, "count");
-					xml_attribute<>* strAttr = findAttribute(accessor, "stride");
-					xml_attribute<>* srcAttr = findAttribute(accessor, "source");
+					xml_attribute<>* cntAttr = detail::findAttribute(accessor, "count");
+					xml_attribute<>* strAttr = detail::findAttribute(accessor, "stride");
+					xml_attribute<>* srcAttr = detail::findAttribute(accessor, "source");
 					if (EXISTS(cntAttr) && EXISTS(strAttr) && EXISTS(srcAttr)) {
-						xml_node<> *float_arr = lib_geometries[ID_SUBSTR(srcAttr->value())];
+						xml_node<> *float_arr = context->idIndex.find(ID_SUBSTR(srcAttr->value()));
 						if (EXISTS(float_arr)) {
-							mesh_source.params = parse_accessor_params(accessor);
-							mesh_source.float_array = parse_float_vector(float_arr->value());
-							mesh_source.stride = stoi(string(strAttr->value()));
-							mesh_source.count = stoi(string(cntAttr->value()));
+							mesh_source.accessor = accessor;
+							mesh_source.values = float_arr->value();
+							mesh_source.stride = strtoul(strAttr->value(), NULL, 10);
+							mesh_source.count = mesh_source.stride > 0 ? strtoul(cntAttr->value(), NULL, 10) : 0;
 						} else {
 							mesh_source.error = 3;
 							ERROR_MSG_NO_FIND("float_array");
@@ -259,164 +1575,443 @@ namespace SimpleCOLLADA {
 			return mesh_source;
 		}
 
-		void parse_geo_normals(xml_node<> *source, ModelNode* model) {
+		/* 
+		 * Appends the source's elements to the node's array, or when streaming, sends them to the visitor as they're 
+		 * decoded, visitorBatchSize at a time, without storing them. Returns how many there were.
+		 */
+		template<typename Stored, typename Convert, typename Send>
+		size_t decode_source(Mesh_source& src, bool streaming, Stored& stored, Convert convert, Send send) {
+			if (!streaming) {
+				size_t before = stored.size();
+				stored.reserve(before + src.count);
+				read_source(src, src.count, [&](const float* values) { stored.push_back(convert(values)); });
+				return stored.size() - before;
+			}
+			vector<typename Stored::value_type> batch;
+			batch.reserve(src.count < options.visitorBatchSize ? src.count : options.visitorBatchSize);
+			size_t total = 0;
+			while (read_source(src, options.visitorBatchSize, [&](const float* values) { batch.push_back(convert(values)); }) > 0) {
+				send(batch.data(), batch.size());
+				total += batch.size();
+				batch.clear();
+			}
+			return total;
+		}
+
+		// Returns how many normals it decoded
+		size_t parse_geo_normals(xml_node<> *source, ModelNode* model, bool streaming) {
 			Mesh_source src = parse_source(source);
 			if (!src.error) { // If no errors had occured...
-				int xOffset = getParamOffset("X", src.params);
-				int yOffset = getParamOffset("Y", src.params);
-				int zOffset = getParamOffset("Z", src.params);
-				for (size_t i = 0; i < src.count; i++) {
-					Normal* n = new Normal();
-					n->nx = src.float_array[i * 3 + xOffset];
-					n->ny = src.float_array[i * 3 + yOffset];
-					n->nz = src.float_array[i * 3 + zOffset];
-					model->addNormal(n);
+				int xOffset = getParamOffset("X", src);
+				int yOffset = getParamOffset("Y", src);
+				int zOffset = getParamOffset("Z", src);
+				if (FOUND_XYZ(xOffset, yOffset, zOffset)) {
+					ModelVisitor* visitor = options.visitor;
+					return decode_source(src, streaming, model->normals, [&](const float* values) -> Normal {
+						Normal n;
+						n.nx = values[xOffset];
+						n.ny = values[yOffset];
+						n.nz = values[zOffset];
+						return n;
+					}, [visitor](const Normal* data, size_t count) { visitor->onNormalBatch(data, count); });
 				}
 			}
+			return 0;
 		}
 
-		void parse_geo_positions(xml_node<> *source, ModelNode* model) {
+		void parse_geo_positions(xml_node<> *source, ModelNode* model, bool streaming) {
 			Mesh_source src = parse_source(source);
 			if (!src.error) { // If no errors had occured...
-				int xOffset = getParamOffset("X", src.params);
-				int yOffset = getParamOffset("Y", src.params);
-				int zOffset = getParamOffset("Z", src.params);
+				int xOffset = getParamOffset("X", src);
+				int yOffset = getParamOffset("Y", src);
+				int zOffset = getParamOffset("Z", src);
 				if (FOUND_XYZ(xOffset, yOffset, zOffset)) {
-					for (size_t i = 0; i < src.count; i++) {
-						Vertex* v = new Vertex;
-						v->x = src.float_array[i * src.stride + xOffset];
-						v->y = src.float_array[i * src.stride + yOffset];
-						v->z = src.float_array[i * src.stride + zOffset];
-						model->addVertex(v);
-					}
+					ModelVisitor* visitor = options.visitor;
+					decode_source(src, streaming, model->vertices, [&](const float* values) -> Vertex {
+						Vertex v;
+						v.x = values[xOffset];
+						v.y = values[yOffset];
+						v.z = values[zOffset];
+						return v;
+					}, [visitor](const Vertex* data, size_t count) { visitor->onVertexBatch(data, count); });
 				}
 			}
 		}
 
-		void parse_geo_texCoords(xml_node<> *source, ModelNode* model) {
+		void parse_geo_texCoords(xml_node<> *source, ModelNode* model, size_t set, bool streaming) {
 			Mesh_source src = parse_source(source);
 			if (!src.error) { // If no errors had occured...
-				int sOffset = getParamOffset("S", src.params);
-				int tOffset = getParamOffset("T", src.params);
+				int sOffset = getParamOffset("S", src);
+				int tOffset = getParamOffset("T", src);
 				if (FOUND_ST(sOffset, tOffset)) {
-					for (size_t i = 0; i < src.count; i++) {
-						TextureCoord* tc = new TextureCoord;
-						tc->u = src.float_array[i * src.stride + sOffset];
-						tc->v = src.float_array[i * src.stride + tOffset];
-						model->addTextureCoord(tc);
-					}
+					ModelVisitor* visitor = options.visitor;
+					decode_source(src, streaming, model->texCoords(set), [&](const float* values) -> TextureCoord {
+						TextureCoord tc;
+						tc.u = values[sOffset];
+						tc.v = values[tOffset];
+						return tc;
+					}, [visitor, set](const TextureCoord* data, size_t count) { visitor->onTexCoordBatch(set, data, count); });
+				}
+			}
+		}
+
+		const char* getColorGroupName(xml_node<> *source) {
+			if (!EXISTS(source)) return "";
+			xml_attribute<>* nameAttr = detail::findAttribute(source, "name");
+			if (!EXISTS(nameAttr)) // Fall back to the source's id, so unnamed groups don't get merged together.
+				nameAttr = detail::findAttribute(source, "id");
+			return EXISTS(nameAttr) ? nameAttr->value() : "";
+		}
+
+		vector<float> parse_geo_luminance(xml_node<> *source) {
+			vector<float> result;
+			Mesh_source src = parse_source(source);
+			if (!src.error && src.stride >= 3) {
+				int rOffset = getParamOffset("R", src);
+				int gOffset = getParamOffset("G", src);
+				int bOffset = getParamOffset("B", src);
+				if (FOUND_XYZ(rOffset, gOffset, bOffset)) {
+					result.reserve(src.count);
+					read_source(src, src.count, [&](const float* values) {
+						result.push_back(values[rOffset] * 0.299f + values[gOffset] * 0.587f + values[bOffset] * 0.114f);
+					});
 				}
 			}
+			return result;
 		}
 
-		void parse_geo_rgb(xml_node<> *source, ModelNode* model) {
+		// Decodes into the group added with addVertexColorGroup. If alphas is set, its values replace the alpha channel of the colors 
+		// (indexed the same way), except for NANs.
+		void parse_geo_rgb(xml_node<> *source, ModelNode* model, int groupId, bool streaming, const vector<float>* alphas = NULL) {
 			Mesh_source src = parse_source(source);
 			if (src.stride < 3) return;
 			if (!src.error) { // If no errors had occured...
-				int rOffset = getParamOffset("R", src.params);
-				int gOffset = getParamOffset("G", src.params);
-				int bOffset = getParamOffset("B", src.params);
-				int aOffset = getParamOffset("A", src.params);
+				int rOffset = getParamOffset("R", src);
+				int gOffset = getParamOffset("G", src);
+				int bOffset = getParamOffset("B", src);
+				int aOffset = getParamOffset("A", src);
 				if (FOUND_XYZ(rOffset, gOffset, bOffset)) {
-					for (size_t i = 0; i < src.count; i++) {
-						VertexColor* vc = new VertexColor;
-						vc->r = src.float_array[i * src.stride + rOffset];
-						vc->g = src.float_array[i * src.stride + gOffset];
-						vc->b = src.float_array[i * src.stride + bOffset];
-						if (FOUND(aOffset) && src.stride > 3) 
-							vc->a = src.float_array[i * src.stride + aOffset];
-						model->addVertexColor(vc, src.name);
-					}
+					ModelVisitor* visitor = options.visitor;
+					const string& group = model->vertexColorGroups[groupId].name;
+					size_t i = 0;
+					decode_source(src, streaming, model->vertexColorGroups[groupId].colors, [&](const float* values) -> VertexColor {
+						VertexColor vc;
+						vc.r = values[rOffset];
+						vc.g = values[gOffset];
+						vc.b = values[bOffset];
+						if (FOUND(aOffset)) 
+							vc.a = values[aOffset];
+						if (alphas != NULL && i < alphas->size() && !isnan((*alphas)[i]))
+							vc.a = (*alphas)[i];
+						i++;
+						return vc;
+					}, [visitor, &group](const VertexColor* data, size_t count) { visitor->onVertexColorBatch(group, data, count); });
 				}
 			}
 		}
 
-		void parse_geo_vertices(xml_node<> *vertices, ModelNode* model) {
+		// Returns how many normals it decoded
+		size_t parse_geo_vertices(xml_node<> *vertices, ModelNode* model, bool streaming) {
+			size_t numOfNormals = 0;
 			for (XML_NODE_CHILD_FOR_LOOP(vertices)) {
-				if (string(child->name()) == "input") {
-					xml_attribute<>* semAttr = findAttribute(child, "semantic");
-					xml_attribute<>* srcAttr = findAttribute(child, "source");
+				if (NAME_EQUALS(child, "input")) {
+					xml_attribute<>* semAttr = detail::findAttribute(child, "semantic");
+					xml_attribute<>* srcAttr = detail::findAttribute(child, "source");
 					if (EXISTS(semAttr) && EXISTS(srcAttr)) {
 						//cout << "semantic = " << semAttr->value() << endl;
 						//cout << "source = " << ID_SUBSTR(srcAttr->value()) << endl;
-						if (string(semAttr->value()) == "POSITION")
-							parse_geo_positions(lib_geometries[ID_SUBSTR(srcAttr->value())], model);
-						else if (string(semAttr->value()) == "NORMAL")
-							parse_geo_normals(lib_geometries[ID_SUBSTR(srcAttr->value())], model);
+						if (VALUE_EQUALS(semAttr, "POSITION"))
+							parse_geo_positions(context->idIndex.find(ID_SUBSTR(srcAttr->value())), model, streaming);
+						else if (VALUE_EQUALS(semAttr, "NORMAL"))
+							numOfNormals += parse_geo_normals(context->idIndex.find(ID_SUBSTR(srcAttr->value())), model, streaming);
 					}
 				}
 			}
+			return numOfNormals;
 		}
 
 		typedef struct _semantics_offsets {
 			int vertexOffset=-1, normalOffset=-1, texCoordOffset=-1, colorOffset=-1;
+			vector<int> texCoordSetOffsets; // Texture coordinate sets after set 0
+			vector<int> colorGroupOffsets; // Vertex color groups after the first one
+			vector<int> colorGroupIds;
+			int alphaOffset = -1; // Offset of LoadOptions::alphaGroup
+			xml_node<> *alphaSource = NULL;
+			vector<xml_node<>*> colorSources; // Every group's, the first group's first. Decoded after the inputs, once the alphas are known.
+			vector<int> colorSourceGroupIds;
+			bool streaming = false; // The sources and indices go straight to LoadOptions::visitor instead of into the ModelNode
+			size_t numOfNormals = 0;
 		} Semantics_offsets;
 
-		void parse_triangles_inputs(xml_node<> *triangles, ModelNode* model, Semantics_offsets& offsets) {
+		int getInputOffset(xml_node<> *input) {
+			xml_attribute<>* offAttr = detail::findAttribute(input, "offset");
+			int offset = EXISTS(offAttr) ? atoi(offAttr->value()) : 0;
+			return offset > 0 ? offset : 0;
+		}
+
+		// Moves the input with set="0" (or no set at all) to the front, so it becomes the set that Triangle indexes.
+		void moveFirstSetToFront(vector<xml_node<>*>& inputs) {
+			for (size_t i = 0; i < inputs.size(); i++) {
+				xml_attribute<>* setAttr = detail::findAttribute(inputs[i], "set");
+				if (!EXISTS(setAttr) || VALUE_EQUALS(setAttr, "0")) {
+					xml_node<>* first = inputs[i];
+					inputs.erase(inputs.begin() + i);
+					inputs.insert(inputs.begin(), first);
+					return;
+				}
+			}
+		}
+
+		void parse_triangles_inputs(xml_node<> *triangles, ModelNode* model, Semantics_offsets& offsets) {
+			vector<xml_node<>*> texCoordInputs, colorInputs;
 			for (XML_NODE_CHILD_FOR_LOOP(triangles)) {
-				if (string(child->name()) == "input") {
-					xml_attribute<>* semAttr = findAttribute(child, "semantic");
-					xml_attribute<>* srcAttr = findAttribute(child, "source");
-					xml_attribute<>* offAttr = findAttribute(child, "offset");
-					xml_attribute<>* setAttr = findAttribute(child, "set");
+				if (NAME_EQUALS(child, "input")) {
+					xml_attribute<>* semAttr = detail::findAttribute(child, "semantic");
+					xml_attribute<>* srcAttr = detail::findAttribute(child, "source");
 					if (EXISTS(semAttr) && EXISTS(srcAttr)) {
-						if (string(semAttr->value()) == "VERTEX") {
-							parse_geo_vertices(lib_geometries[ID_SUBSTR(srcAttr->value())], model);
-							offsets.vertexOffset = stoi(string(offAttr->value()));
-						} else if (string(semAttr->value()) == "NORMAL") {
-							parse_geo_normals(lib_geometries[ID_SUBSTR(srcAttr->value())], model);
-							offsets.normalOffset = stoi(string(offAttr->value()));
-						} else if (string(semAttr->value()) == "TEXCOORD") {
-							offsets.texCoordOffset = stoi(string(offAttr->value()));
-							xml_attribute<>* setAttr = findAttribute(child, "set");
-							if (EXISTS(setAttr)) {
-								if (string(setAttr->value()) == "0")
-									parse_geo_texCoords(lib_geometries[ID_SUBSTR(srcAttr->value())], model);
-							} else {
-								parse_geo_texCoords(lib_geometries[ID_SUBSTR(srcAttr->value())], model);
-							}
-						}
-						else if (string(semAttr->value()) == "COLOR") {
-							if (string(setAttr->value()) == "0")
-								offsets.colorOffset = stoi(string(offAttr->value()));
-							parse_geo_rgb(lib_geometries[ID_SUBSTR(srcAttr->value())], model);
+						if (VALUE_EQUALS(semAttr, "VERTEX")) {
+							offsets.numOfNormals += parse_geo_vertices(context->idIndex.find(ID_SUBSTR(srcAttr->value())), model, offsets.streaming);
+							offsets.vertexOffset = getInputOffset(child);
+						} else if (VALUE_EQUALS(semAttr, "NORMAL")) {
+							offsets.numOfNormals += parse_geo_normals(context->idIndex.find(ID_SUBSTR(srcAttr->value())), model, offsets.streaming);
+							offsets.normalOffset = getInputOffset(child);
+						} else if (VALUE_EQUALS(semAttr, "TEXCOORD")) {
+							texCoordInputs.push_back(child);
+						} else if (VALUE_EQUALS(semAttr, "COLOR")) {
+							colorInputs.push_back(child);
 						}
 					}
 				}
 			}
+			moveFirstSetToFront(texCoordInputs);
+			for (size_t i = 0; i < texCoordInputs.size(); i++) {
+				xml_attribute<>* srcAttr = detail::findAttribute(texCoordInputs[i], "source");
+				xml_attribute<>* setAttr = detail::findAttribute(texCoordInputs[i], "set");
+				parse_geo_texCoords(context->idIndex.find(ID_SUBSTR(srcAttr->value())), model, i, offsets.streaming);
+				if (model->texCoordSetNumbers.size() <= i)
+					model->texCoordSetNumbers.resize(i + 1, 0);
+				model->texCoordSetNumbers[i] = EXISTS(setAttr) ? atoi(setAttr->value()) : 0;
+				if (i == 0)
+					offsets.texCoordOffset = getInputOffset(texCoordInputs[i]);
+				else
+					offsets.texCoordSetOffsets.push_back(getInputOffset(texCoordInputs[i]));
+			}
+			if (!options.alphaGroup.empty() && colorInputs.size() > 1) {
+				for (size_t i = 0; i < colorInputs.size(); i++) {
+					xml_node<>* source = context->idIndex.find(ID_SUBSTR(detail::findAttribute(colorInputs[i], "source")->value()));
+					if (getColorGroupName(source) == options.alphaGroup) {
+						offsets.alphaOffset = getInputOffset(colorInputs[i]);
+						offsets.alphaSource = source;
+						colorInputs.erase(colorInputs.begin() + i);
+						break;
+					}
+				}
+			}
+			moveFirstSetToFront(colorInputs);
+			for (size_t i = 0; i < colorInputs.size(); i++) {
+				xml_attribute<>* srcAttr = detail::findAttribute(colorInputs[i], "source");
+				xml_node<>* source = context->idIndex.find(ID_SUBSTR(srcAttr->value()));
+				int groupId = model->addVertexColorGroup(getColorGroupName(source));
+				offsets.colorSources.push_back(source);
+				offsets.colorSourceGroupIds.push_back(groupId);
+				if (i == 0) {
+					offsets.colorOffset = getInputOffset(colorInputs[i]);
+					model->setFirstVertexColorGroup(groupId);
+				} else {
+					offsets.colorGroupOffsets.push_back(getInputOffset(colorInputs[i]));
+					offsets.colorGroupIds.push_back(groupId);
+				}
+			}
+		}
+
+		// The arrays are sent in place, visitorBatchSize elements at a time
+		template<typename Items, typename Visit>
+		void visitSlices(const Items& items, Visit visit) {
+			for (size_t first = 0; first < items.size(); first += options.visitorBatchSize)
+				visit(items.data() + first, items.size() - first < options.visitorBatchSize ? items.size() - first : options.visitorBatchSize);
+		}
+
+		void visit_vertex_data(ModelNode* model) {
+			ModelVisitor* visitor = options.visitor;
+			visitSlices(model->vertices, [visitor](const Vertex* data, size_t count) { visitor->onVertexBatch(data, count); });
+			visitSlices(model->normals, [visitor](const Normal* data, size_t count) { visitor->onNormalBatch(data, count); });
+			for (size_t set = 0; set < model->texCoordSets.size(); set++)
+				visitSlices(model->texCoordSets[set], [visitor, set](const TextureCoord* data, size_t count) { visitor->onTexCoordBatch(set, data, count); });
+			for (int pass = 0; pass < 2; pass++) { // The group Triangle::color indexes goes first
+				for (size_t k = 0; k < model->vertexColorGroups.size(); k++) {
+					if (((int)k == model->firstVertexColorGroup) != (pass == 0)) continue;
+					const string& group = model->vertexColorGroups[k].name;
+					visitSlices(model->vertexColorGroups[k].colors, [visitor, &group](const VertexColor* data, size_t count) { visitor->onVertexColorBatch(group, data, count); });
+				}
+			}
+		}
+
+		// Sends the index at offset in each corner of the first triCount triangles, re-reading them from the <p>'s text
+		template<typename Send>
+		void visit_index_list(xml_node<>* indices, size_t triCount, size_t stride, int offset, u32* cornerIndices, Send send) {
+			STATS_TIME(stats, decode);
+			vector<long> batch;
+			batch.reserve(triCount * 3 < options.visitorBatchSize ? triCount * 3 : options.visitorBatchSize);
+			const char* str = indices->value();
+			for (size_t i = 0; i < triCount * 3 && detail::read_u32s(str, cornerIndices, stride) == stride; i++) {
+				batch.push_back(cornerIndices[offset]);
+				if (batch.size() == options.visitorBatchSize) {
+					send(batch.data(), batch.size());
+					batch.clear();
+				}
+			}
+			if (!batch.empty())
+				send(batch.data(), batch.size());
+		}
+
+		// Whether a triangle group (or its <vertices>) has normals to decode, without decoding them
+		bool hasNormals(xml_node<> *inputs) {
+			for (XML_NODE_CHILD_FOR_LOOP(inputs)) {
+				if (!NAME_EQUALS(child, "input")) continue;
+				xml_attribute<>* semAttr = detail::findAttribute(child, "semantic");
+				xml_attribute<>* srcAttr = detail::findAttribute(child, "source");
+				if (!EXISTS(semAttr) || !EXISTS(srcAttr)) continue;
+				xml_node<>* source = context->idIndex.find(ID_SUBSTR(srcAttr->value()));
+				if (VALUE_EQUALS(semAttr, "VERTEX") && EXISTS(source) && hasNormals(source))
+					return true;
+				if (VALUE_EQUALS(semAttr, "NORMAL") && EXISTS(source)) {
+					Mesh_source src = parse_source(source);
+					if (!src.error && src.count > 0 && FOUND_XYZ(getParamOffset("X", src), getParamOffset("Y", src), getParamOffset("Z", src)))
+						return true;
+				}
+			}
+			return false;
+		}
+
+		void visit_extra_indices(ModelNode* model) {
+			ModelVisitor* visitor = options.visitor;
+			for (size_t set = 1; set < model->texCoordSetIndices.size(); set++)
+				visitSlices(model->texCoordSetIndices[set], [visitor, set](const long* data, size_t count) { visitor->onTexCoordIndexBatch(set, data, count); });
+			for (size_t k = 0; k < model->vertexColorGroups.size(); k++) {
+				const string& group = model->vertexColorGroups[k].name;
+				visitSlices(model->vertexColorGroups[k].indices, [visitor, &group](const long* data, size_t count) { visitor->onVertexColorIndexBatch(group, data, count); });
+			}
 		}
 
 		void parse_triangles(xml_node<> *triangles, ModelNode* model) {
 			Semantics_offsets offset_pos;
 			xml_node<>* indices = triangles->first_node("p");
-			xml_attribute<>* countAttr = findAttribute(triangles, "count");
+			xml_attribute<>* countAttr = detail::findAttribute(triangles, "count");
 			if (EXISTS(indices) && EXISTS(countAttr)) {
 				bool normalsAreInVertices = false;
-				u32 tri_count = stol(string(countAttr->value()));
+				u32 tri_count = strtoul(countAttr->value(), NULL, 10);
+				// Generating normals needs every triangle first, so that's the one case where the visitor gets the group decoded into the node
+				offset_pos.streaming = EXISTS(options.visitor) && (!options.generateNormals || hasNormals(triangles));
+				bool streaming = offset_pos.streaming;
 				parse_triangles_inputs(triangles, model, offset_pos);
-				vector<u32> index_list = parse_u32_vector(string(indices->value()));
-				u32 stride = index_list.size() / (tri_count * 3);
-				if (offset_pos.normalOffset < 1 && model->getNumOfNormals() > 0)
+				size_t stride = 1; // Every <input> has its own offset in a corner's indices, including the ones that aren't loaded
+				for (XML_NODE_CHILD_FOR_LOOP(triangles))
+					if (NAME_EQUALS(child, "input") && (size_t)getInputOffset(child) + 1 > stride)
+						stride = getInputOffset(child) + 1;
+				// A triangle's indices at a time are read from the <p>'s text, into here unless there are a lot of inputs
+				u32 fewIndices[48];
+				vector<u32> manyIndices;
+				u32* triIndices = fewIndices;
+				if (stride * 3 > 48) {
+					manyIndices.resize(stride * 3);
+					triIndices = manyIndices.data();
+				}
+				if (offset_pos.normalOffset < 1 && offset_pos.numOfNormals > 0)
 					normalsAreInVertices = true;
 				bool hasVerts =	offset_pos.vertexOffset > -1;
 				bool hasTexCoords = offset_pos.texCoordOffset > -1;
 				bool hasNormals = offset_pos.normalOffset > -1;
 				bool hasColors = offset_pos.colorOffset > -1;
-				for (size_t i = 0; i < tri_count; i++) {
-					Triangle* tri = new Triangle();
-					for (size_t j = 0; j < 3; j++) {
-						if (hasVerts)
-							tri->position[j] = index_list[(i*stride*3) + (j*stride) + offset_pos.vertexOffset];
-						if (hasTexCoords)
-							tri->uv[j] = index_list[(i*stride*3) + (j*stride) + offset_pos.texCoordOffset];
-						if (hasColors)
-							tri->color[j] = index_list[(i*stride*3) + (j*stride) + offset_pos.colorOffset];
-						if (normalsAreInVertices)
-							tri->normal[j] = index_list[(i*stride*3) + (j*stride) + offset_pos.vertexOffset];
-						else if (hasNormals) 
-							tri->normal[j] = index_list[(i*stride*3) + (j*stride) + offset_pos.normalOffset];
+				// When streaming, these are sent after the triangles instead, from another pass over the <p>
+				vector<HookVector<long>> texCoordSetIndices(streaming ? 0 : offset_pos.texCoordSetOffsets.size(), HookVector<long>(HookAllocator<long>(model->hooks)));
+				vector<HookVector<long>> colorGroupIndices(streaming ? 0 : offset_pos.colorGroupOffsets.size(), HookVector<long>(HookAllocator<long>(model->hooks)));
+				for (size_t k = 0; k < texCoordSetIndices.size(); k++) texCoordSetIndices[k].reserve(tri_count * 3);
+				for (size_t k = 0; k < colorGroupIndices.size(); k++) colorGroupIndices[k].reserve(tri_count * 3);
+				vector<float> alphas; // NAN for colors no corner gave an alpha, which keep their own
+				if (EXISTS(offset_pos.alphaSource) && !offset_pos.colorSources.empty()) { // Fold the alpha group into the first group while decoding it
+					vector<float> luminance = parse_geo_luminance(offset_pos.alphaSource);
+					// Alphas are stored per color, so a color whose corners have different alphas ends up with the last one
+					const char* str = indices->value();
+					for (size_t i = 0; i < tri_count * 3 && !luminance.empty(); i++) {
+						if (detail::read_u32s(str, triIndices, stride) < stride)
+							break;
+						u32 colorIndex = triIndices[offset_pos.colorOffset];
+						u32 alphaIndex = triIndices[offset_pos.alphaOffset];
+						if (alphaIndex >= luminance.size())
+							continue;
+						if (colorIndex >= alphas.size())
+							alphas.resize(colorIndex + 1, NAN);
+						alphas[colorIndex] = luminance[alphaIndex];
+					}
+				}
+				for (size_t k = 0; k < offset_pos.colorSources.size(); k++) // The first group first, so a visitor gets the group Triangle::color uses first
+					parse_geo_rgb(offset_pos.colorSources[k], model, offset_pos.colorSourceGroupIds[k], streaming, k == 0 ? &alphas : NULL);
+				bool needsNormals = !streaming && options.generateNormals && offset_pos.numOfNormals == 0;
+				vector<Triangle> batch;
+				if (streaming)
+					batch.reserve(tri_count < options.visitorBatchSize ? tri_count : options.visitorBatchSize);
+				else model->triangles.reserve(model->triangles.size() + tri_count);
+				{
+					STATS_TIME(stats, decode);
+					Tracer::Scope trace(options.tracer, "index_array", "decode");
+					const char* str = indices->value();
+					size_t i = 0;
+					for (; i < tri_count; i++) {
+						if (detail::read_u32s(str, triIndices, stride * 3) < stride * 3)
+							break; // The array is shorter than count says
+						Triangle tri;
+						for (size_t j = 0; j < 3; j++) {
+							const u32* corner = triIndices + j * stride;
+							if (hasVerts)
+								tri.position[j] = corner[offset_pos.vertexOffset];
+							if (hasTexCoords)
+								tri.uv[j] = corner[offset_pos.texCoordOffset];
+							if (hasColors)
+								tri.color[j] = corner[offset_pos.colorOffset];
+							if (normalsAreInVertices)
+								tri.normal[j] = corner[offset_pos.vertexOffset];
+							else if (hasNormals) 
+								tri.normal[j] = corner[offset_pos.normalOffset];
+							for (size_t k = 0; k < texCoordSetIndices.size(); k++)
+								texCoordSetIndices[k].push_back(corner[offset_pos.texCoordSetOffsets[k]]);
+							for (size_t k = 0; k < colorGroupIndices.size(); k++)
+								colorGroupIndices[k].push_back(corner[offset_pos.colorGroupOffsets[k]]);
+						}
+						if (streaming) {
+							batch.push_back(tri);
+							if (batch.size() == options.visitorBatchSize) {
+								options.visitor->onTriangleBatch(batch.data(), batch.size());
+								batch.clear();
+							}
+						}
+						else model->addTriangle(tri);
+						if ((i & CANCEL_CHECK_MASK) == CANCEL_CHECK_MASK && loadCancelled())
+							return;
+					}
+					if (!batch.empty())
+						options.visitor->onTriangleBatch(batch.data(), batch.size());
+					STATS_ADD(stats, indicesDecoded, i * stride * 3);
+					trace.count = i * stride * 3;
+					tri_count = i;
+				}
+				for (size_t k = 0; k < texCoordSetIndices.size(); k++)
+					model->setTexCoordIndices(k + 1, texCoordSetIndices[k]);
+				for (size_t k = 0; k < colorGroupIndices.size(); k++)
+					model->setVertexColorIndices(offset_pos.colorGroupIds[k], colorGroupIndices[k]);
+				if (needsNormals)
+					model->generateNormals(options.normalWeighting, options.creaseAngle, options.normalThreads);
+				ModelVisitor* visitor = options.visitor;
+				if (streaming) {
+					for (size_t k = 0; k < offset_pos.texCoordSetOffsets.size(); k++)
+						visit_index_list(indices, tri_count, stride, offset_pos.texCoordSetOffsets[k], triIndices, [visitor, k](const long* data, size_t count) { visitor->onTexCoordIndexBatch(k + 1, data, count); });
+					for (size_t k = 0; k < offset_pos.colorGroupOffsets.size(); k++) {
+						const string& group = model->vertexColorGroups[offset_pos.colorGroupIds[k]].name;
+						visit_index_list(indices, tri_count, stride, offset_pos.colorGroupOffsets[k], triIndices, [visitor, &group](const long* data, size_t count) { visitor->onVertexColorIndexBatch(group, data, count); });
 					}
-					model->addTriangle(tri);
+				} else if (EXISTS(visitor)) {
+					visit_vertex_data(model);
+					visitSlices(model->triangles, [visitor](const Triangle* data, size_t count) { visitor->onTriangleBatch(data, count); });
+					visit_extra_indices(model);
 				}
 			}
 			else {
@@ -424,37 +2019,149 @@ namespace SimpleCOLLADA {
 			}
 		}
 
-		bool checkPolylistIsTriangulated(xml_node<> *polylist) {
-			xml_node<> *vcount = polylist->first_node("vcount");
-			if (EXISTS(vcount)) {
-				vector<u32> vcount_arr = parse_u32_vector(string(vcount->value()));
-				for (size_t i = 0; i < vcount_arr.size(); i++)
-					if (vcount_arr[i] != 3)
-						return false;
-				return true;
+		static bool globMatch(const char* pattern, const char* str) {
+			const char *starPattern = NULL, *starStr = NULL;
+			while (*str) {
+				if (*pattern == '*') {
+					starPattern = ++pattern;
+					starStr = str;
+				} else if (*pattern == '?' || *pattern == *str) {
+					pattern++;
+					str++;
+				} else if (EXISTS(starPattern)) { // Let the last * eat one more character
+					pattern = starPattern;
+					str = ++starStr;
+				} else {
+					return false;
+				}
 			}
+			while (*pattern == '*') pattern++;
+			return *pattern == '\0';
+		}
+
+		// Checks the node's name and id against the patterns. An empty list matches everything.
+		static bool matchesFilter(const vector<string>& patterns, xml_node<> *node) {
+			if (patterns.empty()) return true;
+			xml_attribute<>* nameAttr = detail::findAttribute(node, "name");
+			xml_attribute<>* idAttr = detail::findAttribute(node, "id");
+			for (size_t i = 0; i < patterns.size(); i++)
+				if ((EXISTS(nameAttr) && globMatch(patterns[i].c_str(), nameAttr->value())) || 
+					(EXISTS(idAttr) && globMatch(patterns[i].c_str(), idAttr->value())))
+					return true;
 			return false;
 		}
 
-		void recursivelyFindAllInstanceGeometryNodes(vector<xml_node<>*>& nodes, xml_node<> *current) {
-			if (string(current->name()) == "instance_geometry")
-				nodes.push_back(current);
-			else if (string(current->name()) == "instance_node") {
-				xml_attribute<>* urlAttr = findAttribute(current, "url");
-				if(EXISTS(urlAttr))
-					recursivelyFindAllInstanceGeometryNodes(nodes, lib_visuals[ID_SUBSTR(urlAttr->value())]);
+		// Uses its own stack instead of recursion, so deeply nested scenes can't overflow the call stack.
+		void findAllInstanceGeometryNodes(vector<xml_node<>*>& nodes, xml_node<> *root) {
+			vector<pair<xml_node<>*, bool>> stack(1, make_pair(root, options.nodeNames.empty())); // Node, and if it's under a selected node
+			size_t visited = 0;
+			for (; !stack.empty(); visited++) {
+				xml_node<>* current = stack.back().first;
+				bool selected = stack.back().second;
+				stack.pop_back();
+				if (!EXISTS(current))
+					continue;
+				if (NAME_EQUALS(current, "instance_geometry")) {
+					if (selected)
+						nodes.push_back(current);
+				}
+				else if (NAME_EQUALS(current, "instance_node")) {
+					xml_attribute<>* urlAttr = detail::findAttribute(current, "url");
+					if(EXISTS(urlAttr))
+						stack.push_back(make_pair(context->idIndex.find(ID_SUBSTR(urlAttr->value())), selected));
+				}
+				else if (EXISTS(current->first_node())) { // Push the children backwards, so they come off the stack in document order
+					if (!selected && NAME_EQUALS(current, "node"))
+						selected = matchesFilter(options.nodeNames, current);
+					for (xml_node<>* child = current->last_node(); child; child = child->previous_sibling())
+						stack.push_back(make_pair(child, selected));
+				}
 			}
-			else if (current->first_node() != 0)
-				for (XML_NODE_CHILD_FOR_LOOP(current))
-					recursivelyFindAllInstanceGeometryNodes(nodes, child);
+			STATS_ADD(stats, elementsVisited, visited);
 		}
 
-		int doesMaterialNameAlreadyExist(string name) {
-			for (size_t i = 0; i < materials.size(); i++) {
-				if (materials[i]->getName() == name)
-					return (int)i;
+		xml_node<>* findSidChild(IdIndex& sidMap, const char* sid, const char* childName) {
+			xml_node<>* node = sidMap.find(sid);
+			return EXISTS(node) ? node->first_node(childName) : NULL;
+		}
+
+		void parse_effect(xml_node<> *effect, ParserContext::Effect_record& record) {
+			xml_node<>* profile_COMMON = effect->first_node("profile_COMMON");
+			if (!EXISTS(profile_COMMON)) {
+				ERROR_MSG_NO_FIND("profile_COMMON");
+				return;
 			}
-			return NOT_FOUND;
+			IdIndex& localSidMap = context->sidIndex;
+			localSidMap.clear();
+			buildLocalIdMap(localSidMap, profile_COMMON, "sid");
+			xml_node<>* technique = profile_COMMON->first_node("technique");
+			if (EXISTS(technique) && EXISTS(technique->first_node())) {
+				xml_node<>* diffuse = technique->first_node()->first_node("diffuse");
+				xml_node<>* transparent = technique->first_node()->first_node("transparent");
+				if (EXISTS(diffuse)) {
+					xml_node<>* texture = diffuse->first_node("texture");
+					xml_node<>* color = diffuse->first_node("color");
+					if (EXISTS(texture)) {
+						xml_attribute<>* urlTexAttr = detail::findAttribute(texture, "texture");
+						if (EXISTS(urlTexAttr)) {
+							xml_node<>* sampler2D = findSidChild(localSidMap, urlTexAttr->value(), "sampler2D");
+							if (EXISTS(sampler2D) && EXISTS(sampler2D->first_node("source"))) {
+								xml_node<>* surface = findSidChild(localSidMap, sampler2D->first_node("source")->value(), "surface");
+								if (EXISTS(surface)) {
+									xml_node<>* init_from = surface->first_node("init_from");
+									if (EXISTS(init_from)) {
+										xml_node<>* image = context->idIndex.find(init_from->value());
+										if (EXISTS(image) && EXISTS(image->first_node("init_from"))) {
+											// All of this is here to get the texture's filename. This is the beauty of COLLADA.
+											record.fileName = image->first_node("init_from")->value();
+										} else ERROR_MSG_NO_FIND("image");
+									} else ERROR_MSG_NO_FIND("init_from");
+								} else ERROR_MSG_NO_FIND("surface");
+							} else ERROR_MSG_NO_FIND("sampler2D");
+						} else ERROR_MSG_NO_FIND("urlTexAttr");
+					} else if (EXISTS(color)) {
+						float col_data[4];
+						const char* str = color->value();
+						if (detail::read_floats(str, col_data, 4) >= 3) {
+							u8 r = (u8)(col_data[0] * 255.0), g = (u8)(col_data[1] * 255.0), b = (u8)(col_data[2] * 255.0);
+							record.color = BYTES_TO_UINT(r,g,b,0xFF);
+						}
+					}
+				}
+				if (EXISTS(transparent)) { // Get transparency data
+					xml_attribute<>* opaqueAttr = detail::findAttribute(transparent, "opaque");
+					xml_node<> *color = transparent->first_node("color");
+					float trans_data[4];
+					size_t transCount = 0;
+					if (EXISTS(color)) {
+						const char* str = color->value();
+						transCount = detail::read_floats(str, trans_data, 4);
+					}
+					if (EXISTS(opaqueAttr) && VALUE_EQUALS(opaqueAttr, "A_ONE")) {
+						if (transCount >= 4)
+							record.transparency = trans_data[3];
+					} else if (EXISTS(opaqueAttr) && VALUE_EQUALS(opaqueAttr, "RGB_ZERO")) {
+						if (transCount >= 3)
+							record.transparency = MAX_ABC(trans_data[0], trans_data[1], trans_data[2]);
+					}
+				}
+			} else ERROR_MSG_NO_FIND("technique");
+		}
+
+		// Effects are only decoded the first time a material uses them.
+		const ParserContext::Effect_record& resolve_effect(const char* effectId) {
+			size_t idSize = strlen(effectId);
+			ParserContext::Effect_record* found = context->effectCache.find(effectId, idSize);
+			if (EXISTS(found))
+				return *found;
+			context->effects.push_back(ParserContext::Effect_record());
+			ParserContext::Effect_record& record = context->effects.back();
+			context->effectCache.insert(effectId, idSize, &record);
+			xml_node<>* effect = context->idIndex.find(effectId, idSize);
+			if (EXISTS(effect))
+				parse_effect(effect, record);
+			else ERROR_MSG_NO_FIND("effect");
+			return record;
 		}
 
 		Material* parse_new_material(xml_node<> *mat_node) {
@@ -462,102 +2169,137 @@ namespace SimpleCOLLADA {
 				ERROR_MSG("Material node is null!")
 				return NULL;
 			}
-			Material* mat = new Material;
-			xml_attribute<>* nameAttr = findAttribute(mat_node, "name");
-			if (EXISTS(nameAttr))
-				mat->setName(string(nameAttr->value()));
-			int findMaterial = doesMaterialNameAlreadyExist(mat->getName());
-			if (FOUND(findMaterial)) {
-				delete mat;
-				return materials[findMaterial];
+			STATS_TIME(stats, material);
+			xml_attribute<>* idAttr = detail::findAttribute(mat_node, "id");
+			xml_attribute<>* nameAttr = detail::findAttribute(mat_node, "name");
+			const char* id = EXISTS(idAttr) ? idAttr->value() : "";
+			size_t idSize = EXISTS(idAttr) ? idAttr->value_size() : 0;
+			Material* foundId = context->materialIdMap.find(id, idSize);
+			if (EXISTS(foundId))
+				return foundId;
+			const char* name = EXISTS(nameAttr) ? nameAttr->value() : "";
+			size_t nameSize = EXISTS(nameAttr) ? nameAttr->value_size() : 0;
+			Material* foundName = context->materialNameMap.find(name, nameSize);
+			if (EXISTS(foundName)) {
+				if (EXISTS(idAttr))
+					context->materialIdMap.insert(id, idSize, foundName);
+				return foundName;
 			}
+			Tracer::Scope trace(options.tracer, "material", "scene", name);
+			Material* mat = new Material;
+			mat->setName(string(name, nameSize));
+			if (EXISTS(idAttr))
+				context->materialIdMap.insert(id, idSize, mat);
+			context->materialNameMap.insert(name, nameSize, mat);
 			xml_node<> *instance_effect = mat_node->first_node("instance_effect");
 			if (EXISTS(instance_effect)) {
-				xml_attribute<>* urlAttr = findAttribute(instance_effect, "url");
+				xml_attribute<>* urlAttr = detail::findAttribute(instance_effect, "url");
 				if (EXISTS(urlAttr)) {
-					xml_node<>* effect = lib_effects[ID_SUBSTR(urlAttr->value())];
-					if (EXISTS(effect)) {
-						xml_node<>* profile_COMMON = effect->first_node("profile_COMMON");
-						unordered_map<string, xml_node<>*> localSidMap;
-						buildLocalIdMap(localSidMap, profile_COMMON, "sid");
-						xml_node<>* technique = profile_COMMON->first_node("technique");
-						if (EXISTS(technique) && EXISTS(technique->first_node())) {
-							xml_node<>* diffuse = technique->first_node()->first_node("diffuse");
-							xml_node<>* transparent = technique->first_node()->first_node("transparent");
-							//cout << diffuse->first_node()->name() << endl;
-							if (EXISTS(diffuse)) {
-								xml_node<>* texture = diffuse->first_node("texture");
-								xml_node<>* color = diffuse->first_node("color");
-								if (EXISTS(texture)) {
-									xml_attribute<>* urlTexAttr = findAttribute(texture, "texture");
-									if (EXISTS(urlTexAttr)) {
-										xml_node<>* sampler2D = localSidMap[string(urlTexAttr->value())]->first_node("sampler2D");
-										if (EXISTS(sampler2D) && EXISTS(sampler2D->first_node("source"))) {
-											xml_node<>* surface = localSidMap[string(sampler2D->first_node("source")->value())]->first_node("surface");
-											if (EXISTS(surface)) {
-												xml_node<>* init_from = surface->first_node("init_from");
-												if (EXISTS(init_from)) {
-													xml_node<>* image = lib_images[string(init_from->value())];
-													if (EXISTS(image)) {
-														// All of this is here to get the texture's filename. This is the beauty of COLLADA.
-														mat->setFileName(string(image->first_node("init_from")->value()));
-													} else ERROR_MSG_NO_FIND("image");
-												} else ERROR_MSG_NO_FIND("init_from");
-											} else ERROR_MSG_NO_FIND("surface");
-										} else ERROR_MSG_NO_FIND("sampler2D");
-									} else ERROR_MSG_NO_FIND("urlTexAttr");
-								} else if (EXISTS(color)) {
-									vector<float> col_data = parse_float_vector(string(color->value()));
-									u8 r = (u8)(col_data[0] * 255.0), g = (u8)(col_data[1] * 255.0), b = (u8)(col_data[2] * 255.0);
-									mat->setColor(BYTES_TO_UINT(r,g,b,0xFF));
-								}
-							}
-							if (EXISTS(transparent)) { // Get transparency data
-								xml_attribute<>* opaqueAttr = findAttribute(transparent, "opaque");
-								if (string(opaqueAttr->value()) == "A_ONE") {
-									xml_node<> *color = transparent->first_node("color");
-									if (EXISTS(color)) {
-										vector<float> trans_data = parse_float_vector(string(color->value()));
-										mat->setTransparency(trans_data[3]);
-									}
-								} else if (string(opaqueAttr->value()) == "RGB_ZERO") {
-									xml_node<> *color = transparent->first_node("color");
-									if (EXISTS(color)) {
-										vector<float> trans_data = parse_float_vector(string(color->value()));
-										mat->setTransparency(MAX_ABC(trans_data[0], trans_data[1], trans_data[2]));
-									}
-								}
-							}
-						} else ERROR_MSG_NO_FIND("technique");
-					} else ERROR_MSG_NO_FIND("effect");
+					const ParserContext::Effect_record& effect = resolve_effect(ID_SUBSTR(urlAttr->value()));
+					mat->setFileName(effect.fileName);
+					mat->setColor(effect.color);
+					mat->setTransparency(effect.transparency);
 				} else ERROR_MSG_NO_FIND("urlAttr");
 			} else ERROR_MSG_NO_FIND("instance_effect");
 			materials.push_back(mat);
+			if (EXISTS(options.visitor))
+				options.visitor->onMaterial(mat);
 			return mat;
 		}
 
+		void parse_primitive(xml_node<> *primitive) {
+			xml_attribute<>* matAttr = detail::findAttribute(primitive, "material");
+			Tracer::Scope trace(options.tracer, "primitive", "scene", EXISTS(matAttr) ? matAttr->value() : NULL);
+			xml_node<>* mat_node = EXISTS(matAttr) ? context->materialSymbolTargetMap.find(matAttr->value(), matAttr->value_size()) : NULL;
+			if (!options.materialNames.empty() && (!EXISTS(mat_node) || !matchesFilter(options.materialNames, mat_node)))
+				return;
+			unique_ptr<ModelNode> node(new ModelNode(nodeAllocator)); // Freed if decoding throws
+			ModelNode* model = node.get();
+			if (EXISTS(matAttr)) {
+				model->setMaterial(parse_new_material(mat_node));
+			}
+			if (EXISTS(options.visitor)) { // The temporary node only holds the group's names, unless it needs generated normals
+				xml_attribute<>* countAttr = detail::findAttribute(primitive, "count");
+				xml_attribute<>* geoIdAttr = EXISTS(primitive->parent()) && EXISTS(primitive->parent()->parent()) ? detail::findAttribute(primitive->parent()->parent(), "id") : NULL;
+				options.visitor->onPrimitiveBegin(EXISTS(geoIdAttr) ? geoIdAttr->value() : "", model->getMaterial(), EXISTS(countAttr) ? strtoul(countAttr->value(), NULL, 10) : 0);
+				parse_triangles(primitive, model);
+				options.visitor->onPrimitiveEnd();
+				return;
+			}
+			if (options.lazyDecoding) { // Just remember where it is, and how many triangles it says it has
+				xml_attribute<>* countAttr = detail::findAttribute(primitive, "count");
+				model->owner = this;
+				model->pendingPrimitive = primitive;
+				model->pendingTriangleCount = EXISTS(countAttr) ? strtoul(countAttr->value(), NULL, 10) : 0;
+				model->decoded = false;
+			} else {
+				parse_triangles(primitive, model);
+			}
+			modelNodes.push_back(model);
+			node.release();
+		}
+
+		void decode_primitive(ModelNode* model) {
+			STATS_TIME(stats, scene);
+			xml_attribute<>* matAttr = detail::findAttribute(model->pendingPrimitive, "material");
+			Tracer::Scope trace(options.tracer, "decode node", "scene", EXISTS(matAttr) ? matAttr->value() : NULL);
+			trace.count = model->pendingTriangleCount;
+			xml_node<>* primitive = model->pendingPrimitive;
+			model->pendingPrimitive = NULL; // Cleared first, since parse_triangles goes through the ModelNode's accessors
+			parse_triangles(primitive, model);
+		}
+		friend class ModelNode;
+
+		// For loading a step at a time. A NULL context makes the Model its own.
+		Model(const LoadOptions& loadOptions, ParserContext* shared) : options(loadOptions) {
+#ifdef SIMPLECOLLADA_ENABLE_STATS
+			options.allocator = stats.track(options.allocator);
+#endif
+			if (options.visitorBatchSize == 0)
+				options.visitorBatchSize = 1;
+			nodeAllocator = options.allocator;
+#ifdef SIMPLECOLLADA_ENABLE_SPILL
+			if (options.memoryBudget > 0) {
+				spill.reset(new SpillAllocator(options.memoryBudget, options.spillDirectory, options.allocator));
+				nodeAllocator = spill->allocator();
+			}
+#endif
+			useContext(shared);
+		}
+		bool readDocument(const string& filename) {
+			STATS_TIME(stats, read);
+			Tracer::Scope trace(options.tracer, "read", "load", filename.c_str());
+			bool opened = readFile(filename, context->fileBuffer, options.progress);
+			STATS_ADD(stats, bytesRead, opened ? context->fileBuffer.size() : 0);
+			return opened;
+		}
+		void load(const string& filename) {
+			STATS_TIME(stats, total);
+			Tracer::Scope trace(options.tracer, "load", "file", filename.c_str());
+			bool opened = readDocument(filename);
+			xml_node<>* COLLADA = opened && !loadCancelled() ? parseDocument() : NULL;
+			if (!opened)
+				error = "Could not open \"" + filename + "\"";
+			if (EXISTS(COLLADA)) {
+				buildLibraryMaps(COLLADA);
+				parse_scene(COLLADA->first_node("scene"));
+			}
+			finishLoad(COLLADA);
+		}
+		friend class IncrementalLoad;
+		friend class ModelBatchLoader;
+		friend class ModelPipeline;
+
 		void parse_geometry(xml_node<> *geometry) {
 			xml_node<> *mesh = geometry->first_node("mesh");
 			if (EXISTS(mesh)) {
 				for (XML_NODE_CHILD_FOR_LOOP(mesh)) {
-					if (string(child->name()) == "triangles") { // Sketchup's approach
-						ModelNode* model = new ModelNode();
-						xml_attribute<>* matAttr = findAttribute(child, "material");
-						if (EXISTS(matAttr)) {
-							model->setMaterial(parse_new_material(materialSymbolTargetMap[string(matAttr->value())]));
-						}
-						parse_triangles(child, model);
-						modelNodes.push_back(model);
-					}
-					else if (string(child->name()) == "polylist") { // Blender's approach
-						if (checkPolylistIsTriangulated(child)) {
-							ModelNode* model = new ModelNode();
-							xml_attribute<>* matAttr = findAttribute(child, "material");
-							if (EXISTS(matAttr)) {
-								model->setMaterial(parse_new_material(materialSymbolTargetMap[string(matAttr->value())]));
-							}
-							parse_triangles(child, model);
-							modelNodes.push_back(model);
+					if (NAME_EQUALS(child, "triangles")) { // Sketchup's approach
+						parse_primitive(child);
+					}
+					else if (NAME_EQUALS(child, "polylist")) { // Blender's approach
+						if (detail::checkPolylistIsTriangulated(child)) {
+							parse_primitive(child);
 						}
 						else {
 							ERROR_MSG("Error: Mesh is not triangulated!");
@@ -576,11 +2318,12 @@ namespace SimpleCOLLADA {
 				xml_node<> *technique_common = bind_material->first_node("technique_common");
 				if (EXISTS(technique_common)) {
 					for (XML_NODE_CHILD_FOR_LOOP(technique_common)) {
-						if (string(child->name()) == "instance_material") {
-							xml_attribute<>* mat_tarAttr = findAttribute(child, "target");
-							xml_attribute<>* mat_symAttr = findAttribute(child, "symbol");
+						if (NAME_EQUALS(child, "instance_material")) {
+							xml_attribute<>* mat_tarAttr = detail::findAttribute(child, "target");
+							xml_attribute<>* mat_symAttr = detail::findAttribute(child, "symbol");
 							if (EXISTS(mat_tarAttr) && EXISTS(mat_symAttr)) {
-								materialSymbolTargetMap[string(mat_symAttr->value())] = lib_materials[ID_SUBSTR(mat_tarAttr->value())];
+								xml_node<>* target = context->idIndex.find(ID_SUBSTR(mat_tarAttr->value()));
+								context->materialSymbolTargetMap.insert(mat_symAttr->value(), mat_symAttr->value_size(), target);
 							}
 						}
 					}
@@ -588,24 +2331,15 @@ namespace SimpleCOLLADA {
 			} else ERROR_MSG_NO_FIND("bind_material");
 		}
 
-		void parse_scene(xml_node<> *scene) {
+		void find_scene_geometries(xml_node<> *scene, vector<xml_node<>*>& geonodes) {
+			STATS_TIME(stats, scene);
+			Tracer::Scope trace(options.tracer, "find geometry", "scene");
 			if (EXISTS(scene)) {
 				xml_node<> *ins = scene->first_node("instance_visual_scene");
 				if (EXISTS(ins)) {
-					xml_attribute<>* urlAttr = findAttribute(ins, "url");
-					if (EXISTS(urlAttr)) {
-						vector<xml_node<>*> geonodes;
-						recursivelyFindAllInstanceGeometryNodes(geonodes, lib_visuals[ID_SUBSTR(urlAttr->value())]);
-						if (geonodes.size() > 0) {
-							for (size_t i = 0; i < geonodes.size(); i++) {
-								parse_geo_material(geonodes[i]);
-								xml_attribute<>* geo_urlAttr = findAttribute(geonodes[i], "url");
-								if (EXISTS(geo_urlAttr)) {
-									parse_geometry(lib_geometries[ID_SUBSTR(geo_urlAttr->value())]);
-								}
-							}
-						}
-					}
+					xml_attribute<>* urlAttr = detail::findAttribute(ins, "url");
+					if (EXISTS(urlAttr))
+						findAllInstanceGeometryNodes(geonodes, context->idIndex.find(ID_SUBSTR(urlAttr->value())));
 				} else {
 					ERROR_MSG_NO_FIND("instance_visual_scene");
 				}
@@ -613,60 +2347,1321 @@ namespace SimpleCOLLADA {
 			else {
 				ERROR_MSG("Error: Scene node is NULL!");
 			}
+			if (EXISTS(options.progress))
+				options.progress->geometriesTotal = geonodes.size();
+		}
+
+		void parse_scene_geometry(xml_node<> *geonode) {
+			STATS_TIME(stats, scene);
+			xml_attribute<>* geo_urlAttr = detail::findAttribute(geonode, "url");
+			Tracer::Scope trace(options.tracer, "geometry", "scene", EXISTS(geo_urlAttr) ? ID_SUBSTR(geo_urlAttr->value()) : NULL);
+			xml_node<>* geometry = EXISTS(geo_urlAttr) ? context->idIndex.find(ID_SUBSTR(geo_urlAttr->value())) : NULL;
+			if (EXISTS(geometry) && matchesFilter(options.geometryIds, geometry)) {
+				parse_geo_material(geonode);
+				parse_geometry(geometry);
+			}
+			if (EXISTS(options.progress))
+				options.progress->geometriesDone++;
+		}
+
+		void parse_scene(xml_node<> *scene) {
+			vector<xml_node<>*> geonodes;
+			find_scene_geometries(scene, geonodes);
+			for (size_t i = 0; i < geonodes.size() && !loadCancelled(); i++)
+				parse_scene_geometry(geonodes[i]);
+		}
+
+		// Opens the file and sizes the buffer to fit it
+		static bool openFile(const string& filename, ifstream& infile, HookString& fileBuffer, LoadProgress* progress = NULL) {
+			infile.open(filename, ios::in | ios::binary);
+			if (!infile.is_open()) {
+				ERROR_MSG("Error: Could not open \"" << filename << "\"");
+				return false;
+			}
+			infile.seekg(0, ios::end);
+			streamoff fileSize = infile.tellg();
+			infile.seekg(0, ios::beg);
+			if (EXISTS(progress))
+				progress->bytesTotal = fileSize > 0 ? (size_t)fileSize : 0;
+			fileBuffer.assign(fileSize > 0 ? (size_t)fileSize : 0, '\0'); // Read straight into the buffer rapidxml parses in place
+			return true;
+		}
+		// Reads up to chunkSize more bytes into the buffer, and returns how much of it has been read
+		static size_t readChunk(ifstream& infile, HookString& fileBuffer, size_t done, size_t chunkSize, LoadProgress* progress = NULL) {
+			if (done < fileBuffer.size()) {
+				infile.read(&fileBuffer[done], fileBuffer.size() - done < chunkSize ? fileBuffer.size() - done : chunkSize);
+				done += infile.gcount() > 0 ? (size_t)infile.gcount() : 0;
+				if (infile.gcount() <= 0) // Came up short, so don't try again
+					done = fileBuffer.size();
+			}
+			if (EXISTS(progress))
+				progress->bytesRead = done;
+			return done;
+		}
+		static bool readFile(const string& filename, HookString& fileBuffer, LoadProgress* progress = NULL) {
+			ifstream infile;
+			if (!openFile(filename, infile, fileBuffer, progress))
+				return false;
+			// With progress, read in chunks so it moves and a cancel doesn't wait for the whole file
+			size_t chunkSize = EXISTS(progress) ? 1 << 22 : fileBuffer.size();
+			for (size_t done = 0; done < fileBuffer.size() && !(EXISTS(progress) && progress->isCancelled()); )
+				done = readChunk(infile, fileBuffer, done, chunkSize, progress);
+			infile.close();
+			return true;
+		}
+
+		xml_node<>* parseDocument() {
+			STATS_TIME(stats, parse);
+			Tracer::Scope trace(options.tracer, "parse", "load");
+			xml_node<>* COLLADA = context->parse();
+			if (EXISTS(options.progress))
+				options.progress->documentParsed = true;
+			return EXISTS(COLLADA) && NAME_EQUALS(COLLADA, "COLLADA") ? COLLADA : NULL;
+		}
+		void finishLoad(xml_node<>* COLLADA) {
+			if (EXISTS(COLLADA))
+				upAxis = (UP_AXIS)getUpAxis(COLLADA);
+			else if (error.empty() && !loadCancelled())
+				error = "Not a COLLADA file";
+			if (loadCancelled()) { // Whatever was decoded might be cut short
+				cancelled = true;
+				clear();
+				upAxis = NO_FIND;
+			}
+			options.progress = NULL; // It may not outlive the load
+			if (!options.lazyDecoding || EXISTS(options.visitor) || cancelled) // Nothing points into the document anymore
+				releaseDocument();
+		}
+
+		void releaseDocument() {
+			if (context == ownContext.get())
+				ownContext.reset();
+			else if (EXISTS(context))
+				context->clear(); // Kept warm for its next load
+			context = NULL;
 		}
 
 		void buildLibraryMaps(xml_node<>* COLLADA) {
-			xml_node<>* library_visual_scenes = COLLADA->first_node("library_visual_scenes");
-			xml_node<>* library_geometries = COLLADA->first_node("library_geometries");
-			xml_node<>* library_materials = COLLADA->first_node("library_materials");
-			xml_node<>* library_effects = COLLADA->first_node("library_effects");
-			xml_node<>* library_images = COLLADA->first_node("library_images");
-			if (EXISTS(library_visual_scenes)) buildLocalIdMap(lib_visuals, library_visual_scenes, "id");
-			if (EXISTS(library_geometries)) buildLocalIdMap(lib_geometries, library_geometries, "id");
-			if (EXISTS(library_materials)) buildLocalIdMap(lib_materials, library_materials, "id");
-			if (EXISTS(library_effects)) buildLocalIdMap(lib_effects, library_effects, "id");
-			if (EXISTS(library_images)) buildLocalIdMap(lib_images, library_images, "id");
-		}
-
-		int getUpAxis(xml_node<>* COLLADA) {
+			STATS_TIME(stats, index);
+			Tracer::Scope trace(options.tracer, "index ids", "load");
+			buildLocalIdMap(context->idIndex, COLLADA, "id"); // Ids are unique across the whole document
+		}
+
+		static int getUpAxis(xml_node<>* COLLADA) {
 			xml_node<> *asset = COLLADA->first_node("asset");
 			if (EXISTS(asset)) {
 				xml_node<> *up_axis = asset->first_node("up_axis");
 				if (EXISTS(up_axis)) {
-					string val = string(up_axis->value());
-					if (val == "X_UP")		return 0; // X_UP
-					else if (val == "Y_UP") return 1; // Y_UP
-					else if (val == "Z_UP") return 2; // Z_UP
+					if (VALUE_EQUALS(up_axis, "X_UP"))		return 0; // X_UP
+					else if (VALUE_EQUALS(up_axis, "Y_UP")) return 1; // Y_UP
+					else if (VALUE_EQUALS(up_axis, "Z_UP")) return 2; // Z_UP
 					else					return 3; // INVALID
 				}
 			}
 			return 4; // NO_FIND
 		}
 
+		typedef struct _probe_inputs {
+			size_t positions = 0, normals = 0, texCoords = 0, colors = 0;
+			size_t texCoordSets = 0, colorGroups = 0;
+		} Probe_inputs;
+
+		// The accessor count of a <source> in the mesh
+		static size_t probe_source_count(xml_node<>* mesh, const char* url) {
+			const char* id = ID_SUBSTR(url);
+			for (xml_node<>* source = mesh->first_node("source"); source; source = source->next_sibling("source")) {
+				xml_attribute<>* idAttr = detail::findAttribute(source, "id");
+				if (!EXISTS(idAttr) || strcmp(idAttr->value(), id) != 0) continue;
+				xml_node<>* technique_common = source->first_node("technique_common");
+				xml_node<>* accessor = EXISTS(technique_common) ? technique_common->first_node("accessor") : NULL;
+				xml_attribute<>* countAttr = EXISTS(accessor) ? detail::findAttribute(accessor, "count") : NULL;
+				return EXISTS(countAttr) ? strtoul(countAttr->value(), NULL, 10) : 0;
+			}
+			return 0;
+		}
+
+		static void probe_inputs(xml_node<>* mesh, xml_node<>* parent, Probe_inputs& inputs) {
+			for (xml_node<>* input = parent->first_node("input"); input; input = input->next_sibling("input")) {
+				xml_attribute<>* semanticAttr = detail::findAttribute(input, "semantic");
+				xml_attribute<>* sourceAttr = detail::findAttribute(input, "source");
+				if (!EXISTS(semanticAttr) || !EXISTS(sourceAttr)) continue;
+				if (VALUE_EQUALS(semanticAttr, "POSITION")) {
+					inputs.positions += probe_source_count(mesh, sourceAttr->value());
+				} else if (VALUE_EQUALS(semanticAttr, "NORMAL")) {
+					inputs.normals += probe_source_count(mesh, sourceAttr->value());
+				} else if (VALUE_EQUALS(semanticAttr, "TEXCOORD")) {
+					inputs.texCoords += probe_source_count(mesh, sourceAttr->value());
+					inputs.texCoordSets++;
+				} else if (VALUE_EQUALS(semanticAttr, "COLOR")) {
+					inputs.colors += probe_source_count(mesh, sourceAttr->value());
+					inputs.colorGroups++;
+				}
+			}
+		}
+
+		static void probe_geometries(xml_node<>* library_geometries, ModelInfo& info) {
+			for (xml_node<>* geometry = library_geometries->first_node("geometry"); geometry; geometry = geometry->next_sibling("geometry")) {
+				info.numOfGeometries++;
+				xml_node<>* mesh = geometry->first_node("mesh");
+				if (!EXISTS(mesh)) continue;
+				Probe_inputs vertexInputs; // Every triangle group decodes its own copy of these
+				xml_node<>* vertices = mesh->first_node("vertices");
+				if (EXISTS(vertices))
+					probe_inputs(mesh, vertices, vertexInputs);
+				for (XML_NODE_CHILD_FOR_LOOP(mesh)) {
+					xml_attribute<>* countAttr = detail::findAttribute(child, "count");
+					size_t triangles = 0;
+					if (NAME_EQUALS(child, "triangles")) {
+						if (EXISTS(countAttr))
+							triangles = strtoul(countAttr->value(), NULL, 10);
+					} else if (NAME_EQUALS(child, "polylist")) {
+						if (!detail::checkPolylistIsTriangulated(child)) { // The loader skips these
+							info.numOfUntriangulatedPrimitives++;
+							continue;
+						}
+						if (EXISTS(countAttr))
+							triangles = strtoul(countAttr->value(), NULL, 10);
+					} else continue;
+					info.numOfPrimitives++;
+					info.numOfTriangles += triangles;
+					Probe_inputs inputs = vertexInputs;
+					probe_inputs(mesh, child, inputs);
+					info.numOfPositions += inputs.positions;
+					info.numOfNormals += inputs.normals;
+					info.numOfTexCoords += inputs.texCoords;
+					info.numOfColors += inputs.colors;
+					info.numOfTexCoordSets += inputs.texCoordSets;
+					info.numOfColorGroups += inputs.colorGroups;
+					size_t extraLists = (inputs.texCoordSets > 1 ? inputs.texCoordSets - 1 : 0) + (inputs.colorGroups > 1 ? inputs.colorGroups - 1 : 0);
+					info.numOfExtraIndices += extraLists * triangles * 3;
+				}
+			}
+		}
+
+		// Counts what the loader's document will hold, walking the tree without recursion
+		static void probe_document(xml_node<>* root, ModelInfo& info) {
+			xml_node<>* node = root;
+			while (EXISTS(node)) {
+				info.numOfXmlNodes += node->value_size() > 0 ? 2 : 1; // The loader gives text its own node
+				if (NAME_EQUALS(node, "instance_geometry"))
+					info.numOfGeometryInstances++;
+				for (XML_ATTRIBUTE_FOR_LOOP(node)) {
+					info.numOfXmlAttributes++;
+					if (NAME_EQUALS(attribute, "id")) info.numOfIds++;
+				}
+				if (EXISTS(node->first_node())) {
+					node = node->first_node();
+					continue;
+				}
+				while (node != root && !EXISTS(node->next_sibling()))
+					node = node->parent();
+				node = node != root ? node->next_sibling() : NULL;
+			}
+		}
+
 	public:
-		vector<ModelNode*> modelNodes;
-		vector<Material*> materials;
-		UP_AXIS upAxis;
-		Model(string filename) {
-			ifstream infile;
-			infile.open(filename);
-			stringstream strStream;
-			strStream << infile.rdbuf();
+		/* 
+		 * Reads the up axis, unit, geometry/triangle counts, material names and texture filenames of a file, 
+		 * much faster than loading it. Returns false if the file can't be opened or isn't a COLLADA file 
+		 * (including when it isn't well-formed XML).
+		 */
+		static bool probe(string filename, ModelInfo& info) {
+			HookString fileBuffer;
+			if (!readFile(filename, fileBuffer))
+				return false;
 			xml_document<> doc;
-			string name = strStream.str();
-			doc.parse<0>((char*)name.c_str());
-			if (string(doc.first_node()->name()) == "COLLADA") {
-				buildLibraryMaps(doc.first_node());
-				parse_scene(doc.first_node()->first_node("scene"));
-				upAxis = (UP_AXIS)getUpAxis(doc.first_node());
+			try {
+				doc.parse<parse_no_data_nodes>(&fileBuffer[0]); // Skips creating nodes for the float and index arrays' text
+			} catch (parse_error&) {
+				return false;
 			}
-			infile.close();
+			xml_node<>* COLLADA = doc.first_node();
+			if (!EXISTS(COLLADA) || !NAME_EQUALS(COLLADA, "COLLADA"))
+				return false;
+			info = ModelInfo();
+			info.fileSize = fileBuffer.size();
+			info.upAxis = (UP_AXIS)getUpAxis(COLLADA);
+			probe_document(COLLADA, info);
+			xml_node<>* asset = COLLADA->first_node("asset");
+			xml_node<>* unit = EXISTS(asset) ? asset->first_node("unit") : NULL;
+			if (EXISTS(unit)) {
+				xml_attribute<>* nameAttr = detail::findAttribute(unit, "name");
+				xml_attribute<>* meterAttr = detail::findAttribute(unit, "meter");
+				if (EXISTS(nameAttr)) info.unitName = nameAttr->value();
+				if (EXISTS(meterAttr)) info.unitMeter = strtof(meterAttr->value(), NULL);
+			}
+			for (XML_NODE_CHILD_FOR_LOOP(COLLADA)) {
+				if (NAME_EQUALS(child, "library_geometries")) {
+					probe_geometries(child, info);
+				} else if (NAME_EQUALS(child, "library_materials")) {
+					for (xml_node<>* material = child->first_node("material"); material; material = material->next_sibling("material")) {
+						xml_attribute<>* nameAttr = detail::findAttribute(material, "name"); // Like the loader, unnamed materials get an empty name
+						info.materialNames.push_back(EXISTS(nameAttr) ? nameAttr->value() : "");
+					}
+				} else if (NAME_EQUALS(child, "library_images")) {
+					for (xml_node<>* image = child->first_node("image"); image; image = image->next_sibling("image")) {
+						xml_node<>* init_from = image->first_node("init_from");
+						if (EXISTS(init_from) && EXISTS(init_from->first_node("ref"))) // COLLADA 1.5
+							init_from = init_from->first_node("ref");
+						if (EXISTS(init_from))
+							info.textureFileNames.push_back(init_from->value());
+					}
+				}
+			}
+			return true;
+		}
+
+		/* 
+		 * Roughly what loading the file takes, from what probe() found. parser is only needed while loading (unless decoding is lazy), 
+		 * but it's needed on top of everything else. Filters and visitors make the rest smaller, and generated normals make it bigger.
+		 */
+		static MemoryUsage estimateMemoryUsage(const ModelInfo& info) {
+			MemoryUsage usage;
+			usage.attributes = info.numOfPositions * sizeof(Vertex) + info.numOfNormals * sizeof(Normal) + info.numOfTexCoords * sizeof(TextureCoord);
+			usage.indices = info.numOfTriangles * sizeof(Triangle) + info.numOfExtraIndices * sizeof(long);
+			usage.colorGroups = info.numOfColors * sizeof(VertexColor);
+			usage.nodes = info.numOfPrimitives * (sizeof(ModelNode) + sizeof(ModelNode*)) + info.numOfTexCoordSets * sizeof(HookVector<TextureCoord>) 
+				+ info.numOfColorGroups * sizeof(ModelNode::VertexColorGroup);
+			usage.colorGroups += info.numOfColorGroups * (sizeof(pair<const string, int>) + 2 * sizeof(void*)); // Their entries in the id map
+			if (info.numOfGeometryInstances > info.numOfGeometries && info.numOfGeometries > 0) { // Each instance gets its own ModelNodes
+				double instancing = (double)info.numOfGeometryInstances / info.numOfGeometries;
+				usage.attributes = (size_t)(usage.attributes * instancing);
+				usage.indices = (size_t)(usage.indices * instancing);
+				usage.colorGroups = (size_t)(usage.colorGroups * instancing);
+				usage.nodes = (size_t)(usage.nodes * instancing);
+			}
+			usage.nodes += sizeof(Model);
+			usage.materials = info.materialNames.size() * (sizeof(Material) + sizeof(Material*));
+			for (size_t i = 0; i < info.materialNames.size(); i++)
+				usage.materials += info.materialNames[i].size();
+			usage.parser = sizeof(ParserContext) + info.fileSize + info.numOfXmlNodes * sizeof(xml_node<>) 
+				+ info.numOfXmlAttributes * sizeof(xml_attribute<>) + IdIndex::memoryUsageFor(info.numOfIds);
+			return usage;
+		}
+
+		vector<ModelNode*> modelNodes;
+		vector<Material*> materials;
+		UP_AXIS upAxis = NO_FIND;
+		bool cancelled = false; // LoadOptions::progress was cancelled. The Model is left empty.
+		string error; // Why the file couldn't be loaded, empty if it could
+		Model(string filename, LoadOptions loadOptions = LoadOptions()) : Model(loadOptions, sharedContext(loadOptions)) {
+			load(filename);
+		}
+		// All zeros unless SIMPLECOLLADA_ENABLE_STATS is defined
+		LoadStats getStats() {
+			LoadStats loadStats;
+#ifdef SIMPLECOLLADA_ENABLE_STATS
+			loadStats.readMilliseconds = stats.readNanoseconds / 1e6;
+			loadStats.parseMilliseconds = stats.parseNanoseconds / 1e6;
+			loadStats.indexMilliseconds = stats.indexNanoseconds / 1e6;
+			loadStats.sceneMilliseconds = stats.sceneNanoseconds / 1e6;
+			loadStats.decodeMilliseconds = stats.decodeNanoseconds / 1e6;
+			loadStats.materialMilliseconds = stats.materialNanoseconds / 1e6;
+			loadStats.totalMilliseconds = stats.totalNanoseconds / 1e6;
+			loadStats.bytesRead = stats.bytesRead;
+			loadStats.elementsVisited = stats.elementsVisited;
+			loadStats.floatsDecoded = stats.floatsDecoded;
+			loadStats.indicesDecoded = stats.indicesDecoded;
+			loadStats.hookedAllocations = stats.hookedAllocations;
+			loadStats.hookedPeakBytes = stats.hookedPeakBytes;
+			loadStats.hookedCurrentBytes = stats.hookedCurrentBytes;
+#endif
+			return loadStats;
 		}
 		~Model() { // destructor
+			clear();
+		}
+		// What the Model takes up. Nodes that haven't been decoded yet (LoadOptions::lazyDecoding) aren't decoded by this.
+		MemoryUsage memoryUsage() {
+			MemoryUsage usage;
+			for (size_t i = 0; i < modelNodes.size(); i++)
+				usage.add(modelNodes[i]->memoryUsage());
+			usage.nodes += sizeof(Model) + modelNodes.capacity() * sizeof(ModelNode*);
+			usage.materials = materials.capacity() * sizeof(Material*);
+			for (size_t i = 0; i < materials.size(); i++)
+				usage.materials += sizeof(Material) + materials[i]->getName().capacity() + materials[i]->getFileName().capacity();
+			if (EXISTS(context))
+				usage.parser = context->memoryUsage();
+#ifdef SIMPLECOLLADA_ENABLE_SPILL
+			if (EXISTS(spill))
+				usage.spilled = spill->getMappedBytes();
+#endif
+			return usage;
+		}
+		void clear() {
 			for (size_t i = 0; i < modelNodes.size(); i++) 
 				delete modelNodes[i];
 			for (size_t i = 0; i < materials.size(); i++)
 				delete materials[i];
+			modelNodes.clear();
+			materials.clear();
+			if (EXISTS(context)) {
+				context->materialIdMap.clear();
+				context->materialNameMap.clear();
+			}
+		}
+	};
+
+	inline void ModelNode::decode() {
+		lock_guard<recursive_mutex> lock(decodeMutex);
+		if (EXISTS(pendingPrimitive)) { // Otherwise another thread got to it first, or this one is already decoding it further up
+			owner->decode_primitive(this);
+			decoded.store(true, memory_order_release);
+		}
+	}
+
+	/* 
+	 * Loads a Model on its own thread, e.g. to keep a UI responsive.
+	 * onComplete runs on the loading thread with the new Model (NULL if the file couldn't be parsed), 
+	 * and the Model still belongs to the AsyncLoad until get() is called. Destroying an unfinished AsyncLoad cancels it.
+	 */
+	class AsyncLoad {
+	private:
+		LoadProgress loadProgress;
+		future<Model*> result;
+		Model* model = NULL;
+	public:
+		AsyncLoad(string filename, LoadOptions options = LoadOptions(), function<void(Model*)> onComplete = nullptr) {
+			options.progress = &loadProgress;
+			result = async(launch::async, [filename, options, onComplete]() {
+				Model* loaded = NULL;
+				try {
+					loaded = new Model(filename, options);
+				} catch (...) {
+					if (onComplete) onComplete(NULL);
+					throw;
+				}
+				if (onComplete) onComplete(loaded);
+				return loaded;
+			});
+		}
+		AsyncLoad(const AsyncLoad&) = delete;
+		AsyncLoad& operator=(const AsyncLoad&) = delete;
+		inline const LoadProgress& progress() const { return loadProgress; }
+		inline void cancel() { loadProgress.cancel(); }
+		inline bool isDone() { return !result.valid() || result.wait_for(chrono::seconds(0)) == future_status::ready; }
+		// Waits for the load to finish, and hands over the Model (check Model::cancelled). Returns NULL after the first call.
+		// Rethrows rapidxml::parse_error for malformed files.
+		Model* get() {
+			if (result.valid())
+				model = result.get();
+			Model* loaded = model;
+			model = NULL;
+			return loaded;
+		}
+		~AsyncLoad() { // destructor
+			if (result.valid()) {
+				cancel();
+				try { 
+					model = result.get(); 
+				} catch (...) {}
+			}
+			delete model;
+		}
+	};
+
+	/* 
+	 * Loads a Model a little at a time on the calling thread, for tools that have to keep drawing while they load.
+	 * Each step() reads, parses or decodes until its time budget is used up. The XML parse and the id indexing 
+	 * can't be split up, so the steps doing them can run over. Every ModelNode in getModel()->modelNodes is complete.
+	 * LoadOptions::lazyDecoding is ignored: the steps already spread the decoding out, and decoding on first use would 
+	 * happen outside of any step's budget.
+	 */
+	class IncrementalLoad {
+	private:
+		enum PHASE { READ, PARSE, INDEX, DECODE, DONE };
+		static const size_t READ_CHUNK_SIZE = 1 << 20;
+		Model* model;
+		PHASE phase = READ;
+		ifstream infile;
+		size_t bytesRead = 0;
+		xml_node<>* COLLADA = NULL;
+		vector<xml_node<>*> geonodes;
+		size_t nextGeometry = 0;
+
+		void finish() {
+			if (infile.is_open()) infile.close();
+			model->finishLoad(COLLADA);
+			phase = DONE;
+		}
+	public:
+		IncrementalLoad(string filename, LoadOptions options = LoadOptions()) : model(NULL) {
+			options.lazyDecoding = false;
+			model = new Model(options, Model::sharedContext(options));
+			if (!Model::openFile(filename, infile, model->context->fileBuffer, model->options.progress)) {
+				model->error = "Could not open \"" + filename + "\"";
+				finish();
+			}
+		}
+		IncrementalLoad(const IncrementalLoad&) = delete;
+		IncrementalLoad& operator=(const IncrementalLoad&) = delete;
+
+		// Returns true once the Model is finished. Rethrows rapidxml::parse_error for malformed files, which also finishes it.
+		bool step(long budgetMicroseconds) {
+			if (phase == DONE || !EXISTS(model)) return true; // Also after get() has handed the Model over
+			STATS_TIME(model->stats, total);
+			Tracer::Scope trace(model->options.tracer, "step", "incremental");
+			chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::microseconds(budgetMicroseconds);
+			while (phase != DONE) {
+				if (model->loadCancelled()) {
+					finish();
+					break;
+				}
+				switch (phase) {
+					case READ: {
+						STATS_TIME(model->stats, read);
+						size_t done = Model::readChunk(infile, model->context->fileBuffer, bytesRead, READ_CHUNK_SIZE, model->options.progress);
+						STATS_ADD(model->stats, bytesRead, done - bytesRead);
+						bytesRead = done;
+						if (bytesRead >= model->context->fileBuffer.size()) {
+							infile.close();
+							phase = PARSE;
+						}
+						break;
+					}
+					case PARSE:
+						phase = DONE; // Stays finished if the parse throws
+						COLLADA = model->parseDocument();
+						if (EXISTS(COLLADA)) phase = INDEX;
+						else finish();
+						break;
+					case INDEX:
+						model->buildLibraryMaps(COLLADA);
+						model->find_scene_geometries(COLLADA->first_node("scene"), geonodes);
+						phase = DECODE;
+						break;
+					case DECODE:
+						if (nextGeometry < geonodes.size())
+							model->parse_scene_geometry(geonodes[nextGeometry++]);
+						else finish();
+						break;
+					case DONE:
+						break;
+				}
+				if (chrono::steady_clock::now() >= deadline)
+					break;
+			}
+			return phase == DONE;
+		}
+		inline bool isDone() { return phase == DONE; }
+		inline Model* getModel() { return model; } // Still being built until isDone(). Owned by the IncrementalLoad until get().
+		// Hands over the finished Model, or returns NULL if it isn't done yet (or was already handed over)
+		Model* get() {
+			if (phase != DONE) return NULL;
+			Model* loaded = model;
+			model = NULL;
+			return loaded;
+		}
+		~IncrementalLoad() { // destructor
+			delete model;
+		}
+	};
+
+	typedef struct _BatchResult {
+		string filename;
+		Model* model = NULL; // Belongs to you. NULL if the XML couldn't be parsed, or loading it threw (see error).
+		string error; // Empty if the file loaded
+		double loadMilliseconds = 0; // Reading, parsing and finding the geometry
+		double decodeMilliseconds = 0; // Decoding the geometry, added up over every worker that helped
+		double totalMilliseconds = 0; // From starting the file to finishing it
+	} BatchResult;
+
+	// Where ModelBatchLoader and ModelPipeline put finished files for next() to hand out
+	class BatchResultQueue {
+	private:
+		mutex resultMutex;
+		condition_variable resultCondition;
+		deque<BatchResult> results;
+		size_t resultsLeft;
+	public:
+		BatchResultQueue(size_t fileCount) : resultsLeft(fileCount) {}
+		BatchResultQueue(const BatchResultQueue&) = delete;
+		BatchResultQueue& operator=(const BatchResultQueue&) = delete;
+
+		static double millisecondsSince(chrono::steady_clock::time_point start) {
+			return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+		}
+		// Takes over result.model
+		void push(BatchResult& result) {
+			lock_guard<mutex> lock(resultMutex);
+			results.push_back(result);
+			result.model = NULL;
+			resultCondition.notify_all();
+		}
+		// Waits for the next file to finish, in whatever order they do. Returns false once every file has been returned.
+		bool next(BatchResult& result) {
+			unique_lock<mutex> lock(resultMutex);
+			if (resultsLeft == 0) return false;
+			resultCondition.wait(lock, [this]() { return !results.empty(); });
+			result = results.front();
+			results.pop_front();
+			resultsLeft--;
+			return true;
+		}
+		~BatchResultQueue() { // destructor. Deletes the Models nobody took.
+			for (size_t i = 0; i < results.size(); i++)
+				delete results[i].model;
+		}
+	};
+
+	/* 
+	 * Loads a list of files with a pool of worker threads.
+	 * Every worker has its own queue of tasks and steals from the others when it runs dry. A file with a lot of 
+	 * triangles is loaded lazily, and its ModelNodes are decoded as separate tasks so idle workers can help with it.
+	 * A visitor in the LoadOptions is called from several workers at the same time.
+	 */
+	class ModelBatchLoader {
+	private:
+		static const size_t SPLIT_TRIANGLES = 1 << 16; // Files with more triangles than this get their nodes decoded in parallel
+		static const size_t TASK_TRIANGLES = 1 << 14; // Roughly how many triangles each of those tasks decodes
+
+		ParserContextPool contexts;
+
+		typedef struct _FileJob {
+			BatchResult result;
+			LoadOptions options;
+			chrono::steady_clock::time_point start;
+			atomic<size_t> tasksLeft;
+			mutex decodeMutex; // Guards result.decodeMilliseconds and decodeError
+			string decodeError; // From a decode task that threw
+			ParserContextPool* contexts = NULL;
+			ParserContext* context = NULL; // From contexts, unless the Model keeps its document
+			_FileJob() : tasksLeft(0) {}
+			~_FileJob() { // Only still set if the job was dropped
+				delete result.model;
+				if (EXISTS(context)) contexts->release(context);
+			}
+		} FileJob;
+
+		typedef struct _Worker {
+			mutex queueMutex;
+			deque<function<void()>> tasks; // The owner works from the back, thieves take from the front
+		} Worker;
+
+		vector<unique_ptr<Worker>> workers;
+		vector<thread> threads;
+		mutex wakeMutex;
+		condition_variable wakeCondition;
+		atomic<size_t> queuedTasks, unfinishedTasks;
+		atomic<bool> stopping;
+		Tracer* tracer = NULL;
+
+		BatchResultQueue results;
+
+		void push(size_t workerId, function<void()> task) {
+			unfinishedTasks++;
+			{
+				lock_guard<mutex> lock(workers[workerId]->queueMutex);
+				queuedTasks++; // Before it can be popped, or a thief's decrement could wrap the count
+				workers[workerId]->tasks.push_back(std::move(task));
+			}
+			{ lock_guard<mutex> lock(wakeMutex); } // So a worker can't miss the notify between checking and waiting
+			wakeCondition.notify_all();
+		}
+
+		bool pop(size_t workerId, function<void()>& task) {
+			for (size_t i = 0; i < workers.size(); i++) { // Its own queue first, then everyone else's
+				Worker& worker = *workers[(workerId + i) % workers.size()];
+				lock_guard<mutex> lock(worker.queueMutex);
+				if (worker.tasks.empty()) continue;
+				if (i == 0) {
+					task = std::move(worker.tasks.back());
+					worker.tasks.pop_back();
+				} else {
+					task = std::move(worker.tasks.front());
+					worker.tasks.pop_front();
+				}
+				queuedTasks--;
+				return true;
+			}
+			return false;
+		}
+
+		void work(size_t workerId) {
+			if (EXISTS(tracer)) tracer->setThreadName("Batch worker " + to_string(workerId));
+			for (;;) {
+				function<void()> task;
+				if (pop(workerId, task)) {
+					if (!stopping) task();
+					task = nullptr; // Let go of the job before counting the task as done
+					if (--unfinishedTasks == 0) {
+						{ lock_guard<mutex> lock(wakeMutex); }
+						wakeCondition.notify_all();
+					}
+					continue;
+				}
+				unique_lock<mutex> lock(wakeMutex);
+				wakeCondition.wait(lock, [this]() { return queuedTasks > 0 || unfinishedTasks == 0 || stopping; });
+				if ((unfinishedTasks == 0 || stopping) && queuedTasks == 0)
+					return;
+			}
+		}
+
+		void finishFile(shared_ptr<FileJob> job) {
+			job->result.totalMilliseconds = BatchResultQueue::millisecondsSince(job->start);
+			if (!job->decodeError.empty()) { // Every task is done with the Model by now
+				delete job->result.model;
+				job->result.model = NULL;
+				job->result.error = job->decodeError;
+			}
+			if (EXISTS(job->result.model)) {
+				if (!job->options.lazyDecoding)
+					job->result.model->releaseDocument();
+				job->result.error = job->result.model->error;
+			}
+			if (EXISTS(job->context)) {
+				contexts.release(job->context);
+				job->context = NULL;
+			}
+			results.push(job->result);
+		}
+
+		void decodeNodes(shared_ptr<FileJob> job, size_t first, size_t last) {
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			string error;
+			try {
+				Tracer::Scope trace(tracer, "decode nodes", "batch", job->result.filename.c_str());
+				trace.count = last - first;
+				for (size_t i = first; i < last; i++)
+					job->result.model->modelNodes[i]->ensureDecoded();
+			} catch (exception& e) { // std::bad_alloc, most likely
+				error = e.what();
+			}
+			double elapsed = BatchResultQueue::millisecondsSince(start);
+			{
+				lock_guard<mutex> lock(job->decodeMutex);
+				job->result.decodeMilliseconds += elapsed;
+				if (!error.empty() && job->decodeError.empty())
+					job->decodeError = error;
+			}
+			if (--job->tasksLeft == 0)
+				finishFile(job);
+		}
+
+		void loadFile(size_t workerId, shared_ptr<FileJob> job) {
+			job->start = chrono::steady_clock::now();
+			LoadOptions options = job->options;
+			options.lazyDecoding = !EXISTS(options.visitor); // Decoded below, possibly by several workers
+			if (!job->options.lazyDecoding) {
+				job->contexts = &contexts;
+				job->context = contexts.acquire();
+			}
+			try {
+				job->result.model = new Model(options, job->context);
+				job->result.model->load(job->result.filename);
+			} catch (exception& e) { // rapidxml::parse_error for malformed XML
+				delete job->result.model;
+				job->result.model = NULL;
+				job->result.error = e.what();
+				job->result.loadMilliseconds = BatchResultQueue::millisecondsSince(job->start);
+				finishFile(job);
+				return;
+			}
+			job->result.loadMilliseconds = BatchResultQueue::millisecondsSince(job->start);
+			vector<ModelNode*>& nodes = job->result.model->modelNodes;
+			size_t triangles = 0;
+			for (size_t i = 0; i < nodes.size(); i++)
+				triangles += nodes[i]->pendingTriangleCount;
+			if (job->options.lazyDecoding || EXISTS(options.visitor) || nodes.empty()) {
+				finishFile(job);
+			} else if (triangles <= SPLIT_TRIANGLES || nodes.size() < 2) {
+				job->tasksLeft = 1;
+				decodeNodes(job, 0, nodes.size());
+			} else { // Split the nodes into tasks for this worker's queue, where the others can steal them
+				vector<size_t> splits(1, 0);
+				size_t taskTriangles = 0;
+				for (size_t i = 0; i < nodes.size(); i++) {
+					taskTriangles += nodes[i]->pendingTriangleCount;
+					if (taskTriangles >= TASK_TRIANGLES || i + 1 == nodes.size()) {
+						splits.push_back(i + 1);
+						taskTriangles = 0;
+					}
+				}
+				job->tasksLeft = splits.size() - 1;
+				for (size_t i = 0; i + 1 < splits.size(); i++) {
+					size_t first = splits[i], last = splits[i + 1];
+					push(workerId, [this, job, first, last]() { decodeNodes(job, first, last); });
+				}
+			}
+		}
+
+	public:
+		// threadCount 0 uses one thread per core. LoadOptions::progress and context are ignored, since the workers keep their own contexts.
+		ModelBatchLoader(const vector<string>& filenames, LoadOptions options = LoadOptions(), unsigned threadCount = 0) 
+			: contexts(options.allocator), queuedTasks(0), unfinishedTasks(0), stopping(false), results(filenames.size()) {
+			if (threadCount == 0) threadCount = thread::hardware_concurrency();
+			if (threadCount == 0) threadCount = 1;
+			options.progress = NULL;
+			options.context = NULL;
+			tracer = options.tracer;
+			for (unsigned i = 0; i < threadCount; i++)
+				workers.push_back(unique_ptr<Worker>(new Worker()));
+			for (size_t i = 0; i < filenames.size(); i++) { // Dealt out round robin. Whoever finishes early steals the rest.
+				shared_ptr<FileJob> job = make_shared<FileJob>();
+				job->result.filename = filenames[i];
+				job->options = options;
+				size_t workerId = i % threadCount;
+				push(workerId, [this, workerId, job]() { loadFile(workerId, job); });
+			}
+			for (unsigned i = 0; i < threadCount; i++)
+				threads.push_back(thread(&ModelBatchLoader::work, this, i));
+		}
+		ModelBatchLoader(const ModelBatchLoader&) = delete;
+		ModelBatchLoader& operator=(const ModelBatchLoader&) = delete;
+
+		inline bool next(BatchResult& result) { return results.next(result); } // See BatchResultQueue::next()
+
+		~ModelBatchLoader() { // destructor. Files that haven't finished are dropped.
+			stopping = true;
+			{ lock_guard<mutex> lock(wakeMutex); }
+			wakeCondition.notify_all();
+			for (size_t i = 0; i < threads.size(); i++)
+				threads[i].join();
+		}
+	};
+
+	// A queue that blocks pushes while it's full, and pops while it's empty. After close(), pushes fail and pops drain what's left.
+	template<typename T>
+	class BoundedQueue {
+	private:
+		mutex queueMutex;
+		condition_variable notEmpty, notFull;
+		deque<T> items;
+		size_t capacity;
+		bool closed = false;
+	public:
+		BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1) {}
+		bool push(T item) {
+			unique_lock<mutex> lock(queueMutex);
+			notFull.wait(lock, [this]() { return closed || items.size() < capacity; });
+			if (closed) return false;
+			items.push_back(item);
+			notEmpty.notify_one();
+			return true;
+		}
+		bool pop(T& item) {
+			unique_lock<mutex> lock(queueMutex);
+			notEmpty.wait(lock, [this]() { return closed || !items.empty(); });
+			if (items.empty()) return false;
+			item = items.front();
+			items.pop_front();
+			notFull.notify_one();
+			return true;
+		}
+		void close() {
+			lock_guard<mutex> lock(queueMutex);
+			closed = true;
+			notEmpty.notify_all();
+			notFull.notify_all();
+		}
+	};
+
+	typedef struct _PipelineOptions {
+		unsigned readThreads = 1; // One suits a spinning disk. Reads run ahead of parsing by up to readQueueDepth files.
+		unsigned parseThreads = 2;
+		unsigned buildThreads = 2;
+		size_t readQueueDepth = 4; // Files read and waiting to be parsed
+		size_t parseQueueDepth = 2; // Parsed documents waiting to be built
+	} PipelineOptions;
+
+	/* 
+	 * Loads a list of files in three stages that overlap: reading the files, parsing the XML, and building the 
+	 * ModelNodes. Each stage has its own threads, and the bounded queues between them cap how many files are in 
+	 * memory at once. A visitor in the LoadOptions is called from several build threads at the same time. In the BatchResults, loadMilliseconds is the reading and parsing, and 
+	 * decodeMilliseconds is the building. Time spent waiting in the queues only shows up in totalMilliseconds.
+	 */
+	class ModelPipeline {
+	private:
+		typedef struct _Item {
+			BatchResult result;
+			xml_node<>* COLLADA = NULL;
+			chrono::steady_clock::time_point start;
+			ParserContextPool* contexts = NULL;
+			ParserContext* context = NULL; // From contexts, unless the Model keeps its document
+			~_Item() { // Only still set if the item was dropped
+				delete result.model;
+				if (EXISTS(context)) contexts->release(context);
+			}
+		} Item;
+
+		ParserContextPool contexts; // Bounded by how many files can be in flight
+		vector<string> filenames;
+		LoadOptions options;
+		atomic<size_t> nextFile;
+		BoundedQueue<Item*> readQueue, parseQueue;
+		atomic<unsigned> readersLeft, parsersLeft;
+		atomic<bool> stopping;
+		vector<thread> threads;
+
+		BatchResultQueue results;
+
+		void read() {
+			if (EXISTS(options.tracer)) options.tracer->setThreadName("Pipeline reader");
+			for (size_t i = nextFile++; i < filenames.size() && !stopping; i = nextFile++) {
+				Item* item = new Item();
+				item->start = chrono::steady_clock::now();
+				item->result.filename = filenames[i];
+				if (!options.lazyDecoding || EXISTS(options.visitor)) {
+					item->contexts = &contexts;
+					item->context = contexts.acquire();
+				}
+				item->result.model = new Model(options, item->context);
+				{
+					STATS_TIME(item->result.model->stats, total);
+					if (!item->result.model->readDocument(filenames[i]))
+						item->result.model->error = "Could not open \"" + filenames[i] + "\"";
+				}
+				item->result.loadMilliseconds = BatchResultQueue::millisecondsSince(item->start);
+				if (!readQueue.push(item))
+					delete item;
+			}
+			if (--readersLeft == 0) readQueue.close();
+		}
+
+		void parse() {
+			if (EXISTS(options.tracer)) options.tracer->setThreadName("Pipeline parser");
+			Item* item;
+			while (readQueue.pop(item)) {
+				if (!stopping && item->result.model->error.empty()) {
+					chrono::steady_clock::time_point start = chrono::steady_clock::now();
+					try {
+						STATS_TIME(item->result.model->stats, total);
+						item->COLLADA = item->result.model->parseDocument();
+					} catch (exception& e) { // rapidxml::parse_error for malformed XML
+						item->result.error = e.what();
+						delete item->result.model;
+						item->result.model = NULL;
+					}
+					item->result.loadMilliseconds += BatchResultQueue::millisecondsSince(start);
+				}
+				if (stopping || !parseQueue.push(item))
+					delete item;
+			}
+			if (--parsersLeft == 0) parseQueue.close();
+		}
+
+		void build() {
+			if (EXISTS(options.tracer)) options.tracer->setThreadName("Pipeline builder");
+			Item* item;
+			while (parseQueue.pop(item)) {
+				if (stopping) {
+					delete item;
+					continue;
+				}
+				Model* model = item->result.model;
+				if (EXISTS(model)) {
+					chrono::steady_clock::time_point start = chrono::steady_clock::now();
+					try {
+						STATS_TIME(model->stats, total);
+						Tracer::Scope trace(options.tracer, "build", "pipeline", item->result.filename.c_str());
+						if (EXISTS(item->COLLADA)) {
+							model->buildLibraryMaps(item->COLLADA);
+							model->parse_scene(item->COLLADA->first_node("scene"));
+						}
+						model->finishLoad(item->COLLADA);
+						item->result.error = model->error;
+					} catch (exception& e) { // std::bad_alloc, most likely
+						item->result.error = e.what();
+						delete model;
+						item->result.model = NULL;
+					}
+					item->result.decodeMilliseconds = BatchResultQueue::millisecondsSince(start);
+				}
+				if (EXISTS(item->context)) {
+					contexts.release(item->context);
+					item->context = NULL;
+				}
+				item->result.totalMilliseconds = BatchResultQueue::millisecondsSince(item->start);
+				results.push(item->result);
+				delete item;
+			}
+		}
+
+	public:
+		ModelPipeline(const vector<string>& filenames, LoadOptions loadOptions = LoadOptions(), PipelineOptions pipelineOptions = PipelineOptions())
+			: contexts(loadOptions.allocator), filenames(filenames), options(loadOptions), nextFile(0), readQueue(pipelineOptions.readQueueDepth), parseQueue(pipelineOptions.parseQueueDepth),
+			readersLeft(0), parsersLeft(0), stopping(false), results(filenames.size()) {
+			options.progress = NULL;
+			options.context = NULL; // Each file in flight gets its own from the pool
+			unsigned readThreads = pipelineOptions.readThreads > 0 ? pipelineOptions.readThreads : 1;
+			unsigned parseThreads = pipelineOptions.parseThreads > 0 ? pipelineOptions.parseThreads : 1;
+			unsigned buildThreads = pipelineOptions.buildThreads > 0 ? pipelineOptions.buildThreads : 1;
+			readersLeft = readThreads;
+			parsersLeft = parseThreads;
+			for (unsigned i = 0; i < readThreads; i++) threads.push_back(thread(&ModelPipeline::read, this));
+			for (unsigned i = 0; i < parseThreads; i++) threads.push_back(thread(&ModelPipeline::parse, this));
+			for (unsigned i = 0; i < buildThreads; i++) threads.push_back(thread(&ModelPipeline::build, this));
+		}
+		ModelPipeline(const ModelPipeline&) = delete;
+		ModelPipeline& operator=(const ModelPipeline&) = delete;
+
+		inline bool next(BatchResult& result) { return results.next(result); } // See BatchResultQueue::next()
+
+		~ModelPipeline() { // destructor. Files that haven't finished are dropped.
+			stopping = true;
+			readQueue.close();
+			parseQueue.close();
+			for (size_t i = 0; i < threads.size(); i++)
+				threads[i].join();
+		}
+	};
+
+	typedef struct _GLBOptions {
+		bool interleaved = true; // A primitive's attributes side by side in one buffer view. Otherwise each attribute gets its own view.
+		bool fixUpAxis = true; // Turns X_UP and Z_UP Models so Y is up, like glTF expects
+	} GLBOptions;
+
+	/* 
+	 * Writes a Model as a binary glTF 2.0 (.glb) file, in one mesh with a primitive for every material (and set of attributes).
+	 * Corners with the same position, normal, texture coordinate and color indices get welded into one vertex. Materials keep 
+	 * their color, transparency and texture, whose filename becomes the image's uri. Texture coordinates have v flipped, 
+	 * since glTF's start at the top of the image. The file is put together in one buffer and written all at once.
+	 */
+	class GLBExporter {
+	private:
+		typedef struct _Corner { // What a welded vertex is made of. -1 for anything it doesn't have.
+			long position, normal, uv, color; // A normal of -2 - t is triangle t's face normal
+			inline bool operator==(const _Corner& other) const {
+				return position == other.position && normal == other.normal && uv == other.uv && color == other.color;
+			}
+		} Corner;
+		struct CornerHash {
+			inline size_t operator()(const Corner& c) const {
+				return ((((size_t)c.position * 31) + (size_t)c.normal) * 31 + (size_t)c.uv) * 31 + (size_t)c.color;
+			}
+		};
+		typedef struct _Primitive {
+			Material* material = NULL;
+			bool normals = false, texCoords = false, colors = false;
+			vector<ModelNode*> nodes;
+			vector<size_t> nodeEnds; // Where each node's vertices end in vertices
+			vector<Corner> vertices;
+			vector<u32> indices;
+			float min[3], max[3]; // Of the positions, which glTF needs
+			size_t indexOffset = 0, attributeOffsets[4] = {}, attributeStrides[4] = {}; // Where they go in the binary chunk
+		} Primitive;
+		enum { POSITION, NORMAL, TEXCOORD, COLOR };
+
+		Model* model;
+		GLBOptions options;
+		vector<Primitive> primitives;
+
+		static int colorGroup(ModelNode* node) { // The group in Triangle::color
+			if (node->getNumOfVertexColorGroups() == 0) return NOT_FOUND;
+			return node->getVertexColorGroupId(node->getFirstVertexColorGroupName());
+		}
+		inline void orient(float x, float y, float z, float* out) const {
+			UP_AXIS up = options.fixUpAxis ? model->upAxis : Y_UP;
+			if (up == Z_UP) { out[0] = x; out[1] = z; out[2] = -y; }
+			else if (up == X_UP) { out[0] = -y; out[1] = x; out[2] = z; }
+			else { out[0] = x; out[1] = y; out[2] = z; }
+		}
+		static void writeFloat(ostream& out, float f) {
+			char number[32];
+			snprintf(number, sizeof(number), "%.9g", isfinite(f) ? f : 0.0f); // Enough digits to read back the same float
+			out << number;
+		}
+		static void writeU32(char* dest, u32 value) { // glTF is little endian
+			dest[0] = (char)(value & 0xFF);
+			dest[1] = (char)((value >> 8) & 0xFF);
+			dest[2] = (char)((value >> 16) & 0xFF);
+			dest[3] = (char)((value >> 24) & 0xFF);
+		}
+		static bool hasLength(const Normal& n) { return n.nx != 0.0f || n.ny != 0.0f || n.nz != 0.0f; }
+		// For corners without a usable normal, since glTF needs every normal to be unit length
+		void faceNormal(ModelNode* node, size_t t, float* out) const {
+			Triangle* tri = node->getTriangle(t);
+			Vertex& a = *node->getVertex(tri->position[0]);
+			Vertex& b = *node->getVertex(tri->position[1]);
+			Vertex& c = *node->getVertex(tri->position[2]);
+			float ux = b.x - a.x, uy = b.y - a.y, uz = b.z - a.z, vx = c.x - a.x, vy = c.y - a.y, vz = c.z - a.z;
+			float nx = uy * vz - uz * vy, ny = uz * vx - ux * vz, nz = ux * vy - uy * vx;
+			float length = sqrt(nx * nx + ny * ny + nz * nz);
+			if (length > 0.0f) orient(nx / length, ny / length, nz / length, out);
+			else { out[0] = 0.0f; out[1] = 1.0f; out[2] = 0.0f; } // Degenerate, so any direction will do
+		}
+		static inline size_t padded(size_t bytes) { return (bytes + 3) & ~(size_t)3; }
+		static inline bool shortIndices(const Primitive& primitive) { return primitive.vertices.size() <= 0xFFFF; }
+
+		// Sorts the ModelNodes into primitives, and welds their corners
+		void weld() {
+			unordered_map<Corner, u32, CornerHash> welded;
+			unordered_map<Material*, vector<size_t>> materialPrimitives; // Usually one, unless the nodes have different attributes
+			for (size_t i = 0; i < model->modelNodes.size(); i++) {
+				ModelNode* node = model->modelNodes[i];
+				size_t numVerts = node->getNumOfVertices(), numTris = node->getNumOfTriangles();
+				if (numVerts == 0 || numTris == 0) continue;
+				int group = colorGroup(node);
+				bool normals = node->getNumOfNormals() > 0, texCoords = node->getNumOfTexCoords() > 0;
+				bool colors = group != NOT_FOUND && node->getNumOfVertexColors(group) > 0;
+				vector<size_t>& candidates = materialPrimitives[node->getMaterial()];
+				size_t p = primitives.size();
+				for (size_t c = 0; c < candidates.size() && p == primitives.size(); c++) {
+					Primitive& candidate = primitives[candidates[c]];
+					if (candidate.normals == normals && candidate.texCoords == texCoords && candidate.colors == colors) p = candidates[c];
+				}
+				if (p == primitives.size()) {
+					candidates.push_back(p);
+					primitives.push_back(Primitive());
+					primitives[p].material = node->getMaterial();
+					primitives[p].normals = normals;
+					primitives[p].texCoords = texCoords;
+					primitives[p].colors = colors;
+					for (int k = 0; k < 3; k++) {
+						primitives[p].min[k] = INFINITY;
+						primitives[p].max[k] = -INFINITY;
+					}
+				}
+				Primitive& primitive = primitives[p];
+				size_t numNormals = node->getNumOfNormals(), numTexCoords = node->getNumOfTexCoords();
+				size_t numColors = colors ? node->getNumOfVertexColors(group) : 0;
+				Triangle* triangles = node->getTriangle(0);
+				Vertex* positions = node->getVertex(0);
+				Normal* nodeNormals = normals ? node->getNormal(0) : NULL;
+				welded.clear();
+				welded.reserve(numVerts);
+				primitive.indices.reserve(primitive.indices.size() + numTris * 3);
+				for (size_t t = 0; t < numTris; t++) {
+					Triangle& tri = triangles[t];
+					if (tri.position[0] < 0 || tri.position[1] < 0 || tri.position[2] < 0 || (size_t)tri.position[0] >= numVerts
+						|| (size_t)tri.position[1] >= numVerts || (size_t)tri.position[2] >= numVerts) continue;
+					for (int c = 0; c < 3; c++) {
+						Corner corner;
+						corner.position = tri.position[c];
+						corner.normal = normals && tri.normal[c] >= 0 && (size_t)tri.normal[c] < numNormals ? tri.normal[c] : -1;
+						if (normals && (corner.normal < 0 || !hasLength(nodeNormals[corner.normal])))
+							corner.normal = -2 - (long)t; // Not welded with other triangles' corners
+						corner.uv = texCoords && tri.uv[c] >= 0 && (size_t)tri.uv[c] < numTexCoords ? tri.uv[c] : -1;
+						long color = colors ? node->getVertexColorIndex(group, (int)t, c) : -1;
+						corner.color = color >= 0 && (size_t)color < numColors ? color : -1;
+						auto found = welded.find(corner);
+						if (found == welded.end()) {
+							found = welded.insert(make_pair(corner, (u32)primitive.vertices.size())).first;
+							primitive.vertices.push_back(corner);
+							float position[3];
+							Vertex& v = positions[corner.position];
+							orient(v.x, v.y, v.z, position);
+							for (int k = 0; k < 3; k++) {
+								if (position[k] < primitive.min[k]) primitive.min[k] = position[k];
+								if (position[k] > primitive.max[k]) primitive.max[k] = position[k];
+							}
+						}
+						primitive.indices.push_back(found->second);
+					}
+				}
+				primitive.nodes.push_back(node);
+				primitive.nodeEnds.push_back(primitive.vertices.size());
+			}
+			for (size_t p = primitives.size(); p-- > 0;) // Everything in it was skipped
+				if (primitives[p].indices.empty()) primitives.erase(primitives.begin() + p);
+		}
+
+		// Writes the JSON chunk, and works out where everything goes in the binary chunk. Returns the binary chunk's size.
+		size_t layout(ostream& json) {
+			ostringstream meshes, accessors, views, materialJson, imageJson;
+			unordered_map<Material*, size_t> materials;
+			unordered_map<string, size_t> images;
+			size_t binSize = 0, numAccessors = 0, numViews = 0;
+			for (size_t p = 0; p < primitives.size(); p++) {
+				Primitive& primitive = primitives[p];
+				size_t count = primitive.vertices.size();
+				bool isShort = shortIndices(primitive);
+				size_t indexBytes = primitive.indices.size() * (isShort ? 2 : 4);
+				primitive.indexOffset = binSize;
+				views << (numViews ? "," : "") << "{\"buffer\":0,\"byteOffset\":" << binSize << ",\"byteLength\":" << indexBytes << ",\"target\":34963}";
+				accessors << (numAccessors ? "," : "") << "{\"bufferView\":" << numViews << ",\"componentType\":" << (isShort ? 5123 : 5125) 
+					<< ",\"count\":" << primitive.indices.size() << ",\"type\":\"SCALAR\"}";
+				size_t indexAccessor = numAccessors++;
+				numViews++;
+				binSize += padded(indexBytes);
+
+				static const char* names[4] = { "POSITION", "NORMAL", "TEXCOORD_0", "COLOR_0" };
+				static const char* types[4] = { "VEC3", "VEC3", "VEC2", "VEC4" };
+				static const size_t sizes[4] = { 12, 12, 8, 16 };
+				bool used[4] = { true, primitive.normals, primitive.texCoords, primitive.colors };
+				size_t stride = 0;
+				for (int a = 0; a < 4; a++)
+					if (used[a]) stride += sizes[a];
+				if (options.interleaved)
+					views << ",{\"buffer\":0,\"byteOffset\":" << binSize << ",\"byteLength\":" << count * stride << ",\"byteStride\":" << stride << ",\"target\":34962}";
+				meshes << (p ? "," : "") << "{\"attributes\":{";
+				size_t offset = 0;
+				for (int a = 0; a < 4; a++) {
+					if (!used[a]) continue;
+					if (!options.interleaved)
+						views << ",{\"buffer\":0,\"byteOffset\":" << binSize + offset << ",\"byteLength\":" << count * sizes[a] << ",\"target\":34962}";
+					primitive.attributeOffsets[a] = binSize + offset;
+					primitive.attributeStrides[a] = options.interleaved ? stride : sizes[a];
+					accessors << ",{\"bufferView\":" << (options.interleaved ? numViews : numViews++);
+					if (options.interleaved) accessors << ",\"byteOffset\":" << offset;
+					accessors << ",\"componentType\":5126,\"count\":" << count << ",\"type\":\"" << types[a] << "\"";
+					if (a == POSITION) {
+						accessors << ",\"min\":[";
+						for (int k = 0; k < 3; k++) { if (k) accessors << ","; writeFloat(accessors, primitive.min[k]); }
+						accessors << "],\"max\":[";
+						for (int k = 0; k < 3; k++) { if (k) accessors << ","; writeFloat(accessors, primitive.max[k]); }
+						accessors << "]";
+					}
+					accessors << "}";
+					meshes << (a ? "," : "") << "\"" << names[a] << "\":" << numAccessors++;
+					offset += options.interleaved ? sizes[a] : count * sizes[a];
+				}
+				if (options.interleaved) numViews++;
+				binSize += count * stride;
+				meshes << "},\"indices\":" << indexAccessor;
+
+				if (EXISTS(primitive.material)) {
+					auto found = materials.insert(make_pair(primitive.material, materials.size()));
+					size_t m = found.first->second;
+					if (found.second) {
+						Material* mat = primitive.material;
+						u32 color = mat->getColor();
+						materialJson << (m ? "," : "") << "{\"name\":";
+						writeJSONString(materialJson, mat->getName());
+						materialJson << ",\"pbrMetallicRoughness\":{\"baseColorFactor\":[";
+						writeFloat(materialJson, ((color >> 24) & 0xFF) / 255.0f);
+						materialJson << ",";
+						writeFloat(materialJson, ((color >> 16) & 0xFF) / 255.0f);
+						materialJson << ",";
+						writeFloat(materialJson, ((color >> 8) & 0xFF) / 255.0f);
+						materialJson << ",";
+						writeFloat(materialJson, mat->getTransparency());
+						materialJson << "]";
+						if (!mat->getFileName().empty()) {
+							auto foundImage = images.insert(make_pair(mat->getFileName(), images.size()));
+							size_t image = foundImage.first->second;
+							if (foundImage.second) {
+								imageJson << (image ? "," : "") << "{\"uri\":";
+								writeJSONString(imageJson, mat->getFileName());
+								imageJson << "}";
+							}
+							materialJson << ",\"baseColorTexture\":{\"index\":" << image << "}";
+						}
+						materialJson << ",\"metallicFactor\":0}";
+						if (mat->getTransparency() < 1.0f) materialJson << ",\"alphaMode\":\"BLEND\"";
+						materialJson << "}";
+					}
+					meshes << ",\"material\":" << m;
+				}
+				meshes << "}";
+			}
+
+			json << "{\"asset\":{\"version\":\"2.0\",\"generator\":\"SimpleCOLLADA\"},\"scene\":0";
+			if (primitives.empty()) {
+				json << ",\"scenes\":[{}]}";
+				return 0;
+			}
+			json << ",\"scenes\":[{\"nodes\":[0]}],\"nodes\":[{\"mesh\":0}],\"meshes\":[{\"primitives\":[" << meshes.str() << "]}]"
+				<< ",\"accessors\":[" << accessors.str() << "],\"bufferViews\":[" << views.str() << "],\"buffers\":[{\"byteLength\":" << binSize << "}]";
+			if (!materials.empty()) json << ",\"materials\":[" << materialJson.str() << "]";
+			if (!images.empty()) {
+				json << ",\"textures\":[";
+				for (size_t i = 0; i < images.size(); i++)
+					json << (i ? "," : "") << "{\"source\":" << i << "}";
+				json << "],\"images\":[" << imageJson.str() << "]";
+			}
+			json << "}";
+			return binSize;
+		}
+
+		// Copies the welded vertices and indices straight from the ModelNodes into the binary chunk. Floats are assumed to be little endian.
+		void fill(char* bin) {
+			for (size_t p = 0; p < primitives.size(); p++) {
+				Primitive& primitive = primitives[p];
+				if (shortIndices(primitive)) {
+					u16* indices = (u16*)(bin + primitive.indexOffset);
+					for (size_t i = 0; i < primitive.indices.size(); i++) indices[i] = (u16)primitive.indices[i];
+				} else memcpy(bin + primitive.indexOffset, primitive.indices.data(), primitive.indices.size() * sizeof(u32));
+
+				size_t v = 0;
+				for (size_t n = 0; n < primitive.nodes.size(); n++) {
+					ModelNode* node = primitive.nodes[n];
+					int group = colorGroup(node);
+					Vertex* positions = node->getVertex(0);
+					Normal* normals = primitive.normals ? node->getNormal(0) : NULL;
+					TextureCoord* texCoords = primitive.texCoords ? node->getTextureCoord(0) : NULL;
+					VertexColor* colors = primitive.colors ? node->getVertexColors(group) : NULL;
+					for (; v < primitive.nodeEnds[n]; v++) {
+						const Corner& corner = primitive.vertices[v];
+						float* out = (float*)(bin + primitive.attributeOffsets[POSITION] + v * primitive.attributeStrides[POSITION]);
+						Vertex& position = positions[corner.position];
+						orient(position.x, position.y, position.z, out);
+						if (EXISTS(normals)) {
+							out = (float*)(bin + primitive.attributeOffsets[NORMAL] + v * primitive.attributeStrides[NORMAL]);
+							if (corner.normal >= 0) {
+								Normal& normal = normals[corner.normal];
+								float length = 1.0f / sqrt(normal.nx * normal.nx + normal.ny * normal.ny + normal.nz * normal.nz); // glTF needs them to be unit length
+								orient(normal.nx * length, normal.ny * length, normal.nz * length, out);
+							} else faceNormal(node, (size_t)(-2 - corner.normal), out);
+						}
+						if (EXISTS(texCoords)) {
+							out = (float*)(bin + primitive.attributeOffsets[TEXCOORD] + v * primitive.attributeStrides[TEXCOORD]);
+							out[0] = corner.uv >= 0 ? texCoords[corner.uv].u : 0.0f;
+							out[1] = corner.uv >= 0 ? 1.0f - texCoords[corner.uv].v : 0.0f;
+						}
+						if (EXISTS(colors)) {
+							out = (float*)(bin + primitive.attributeOffsets[COLOR] + v * primitive.attributeStrides[COLOR]);
+							VertexColor white;
+							white.r = white.g = white.b = 1.0f;
+							const VertexColor& color = corner.color >= 0 ? colors[corner.color] : white;
+							out[0] = color.r;
+							out[1] = color.g;
+							out[2] = color.b;
+							out[3] = color.a;
+						}
+					}
+				}
+			}
+		}
+	public:
+		GLBExporter(Model* model, const GLBOptions& options = GLBOptions()) : model(model), options(options) {}
+
+		static const unsigned long long MAX_GLB_SIZE = 0xFFFFFFFFull; // The header and chunk lengths are 32 bits
+
+		// Returns false, without writing anything, if the model is too big for a GLB
+		bool write(ostream& out) {
+			primitives.clear();
+			weld();
+			ostringstream jsonStream;
+			size_t binSize = layout(jsonStream);
+			string json = jsonStream.str();
+			json.resize(padded(json.size()), ' ');
+			size_t total = 12 + 8 + json.size() + (binSize > 0 ? 8 + binSize : 0);
+			if ((unsigned long long)total > MAX_GLB_SIZE) { // Each chunk is smaller than the whole file, so this covers their lengths too
+				ERROR_MSG("Error: The model is " << total << " bytes as a GLB, more than the format's 4 GiB limit");
+				primitives.clear();
+				return false;
+			}
+			vector<char> file(total, 0);
+			writeU32(&file[0], 0x46546C67); // "glTF"
+			writeU32(&file[4], 2);
+			writeU32(&file[8], (u32)total);
+			writeU32(&file[12], (u32)json.size());
+			writeU32(&file[16], 0x4E4F534A); // "JSON"
+			memcpy(&file[20], json.data(), json.size());
+			if (binSize > 0) {
+				char* chunk = &file[20 + json.size()];
+				writeU32(chunk, (u32)binSize);
+				writeU32(chunk + 4, 0x004E4942); // "BIN"
+				fill(chunk + 8);
+			}
+			out.write(file.data(), file.size());
+			primitives.clear();
+			return true;
+		}
+		// Returns false if the file couldn't be written, and removes it if the model was too big
+		bool write(const string& filename) {
+			ofstream outfile(filename, ios::out | ios::binary);
+			if (!outfile.is_open()) {
+				ERROR_MSG("Error: Could not open \"" << filename << "\"");
+				return false;
+			}
+			if (!write(outfile)) {
+				outfile.close();
+				remove(filename.c_str());
+				return false;
+			}
+			return outfile.good();
 		}
 	};
 
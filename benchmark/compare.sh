@@ -0,0 +1,34 @@
+#!/bin/sh
+# Builds load.cpp against SimpleCOLLADA.hpp as of two git revisions and loads the same files with each, so a change
+# can be measured against the code before it. Every line of JSON gets a "revision" field. Run it from the repository's root:
+#
+#   benchmark/compare.sh <before> <after> [-r runs] file.dae...
+#
+# Revisions from before writeJSONString are built with LOAD_WITHOUT_STATS. Set CXX to use another compiler.
+set -e
+if [ $# -lt 3 ]; then
+	echo "usage: $0 <before> <after> [-r runs] file.dae..." >&2
+	exit 1
+fi
+before=$1
+after=$2
+shift 2
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+build=0
+for revision in "$before" "$after"; do
+	build=$((build + 1))
+	mkdir -p "$dir/$build/SimpleCOLLADA"
+	git show "$revision:SimpleCOLLADA/SimpleCOLLADA.hpp" > "$dir/$build/SimpleCOLLADA/SimpleCOLLADA.hpp"
+	git show "$revision:SimpleCOLLADA/rapidxml.hpp" > "$dir/$build/SimpleCOLLADA/rapidxml.hpp"
+	flags=
+	grep -q "writeJSONString" "$dir/$build/SimpleCOLLADA/SimpleCOLLADA.hpp" || flags=-DLOAD_WITHOUT_STATS
+	${CXX:-g++} -std=c++11 -O2 -pthread -w $flags -I"$dir/$build" benchmark/load.cpp -o "$dir/$build/load"
+done
+
+build=0
+for revision in "$before" "$after"; do
+	build=$((build + 1))
+	"$dir/$build/load" "$@" | sed "s/}\$/,\"revision\":\"$revision\"}/"
+done
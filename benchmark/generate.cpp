@@ -0,0 +1,250 @@
+/*
+ * Writes synthetic COLLADA files shaped like Blender and SketchUp exports, to benchmark loads on.
+ * The same arguments always give the same file.
+ *
+ *   generate <blender|sketchup> <triangles> <out.dae> [geometries] [materials] [instances]
+ *
+ * triangles is how many there are in library_geometries (1000 to 50000000 or so), split between geometries
+ * (triangles / 2000 by default). Every geometry has a triangle group for each of up to 3 of the materials (16 by default),
+ * which share the geometry's sources, and is instanced by instances scene nodes (1 for Blender, 4 for SketchUp),
+ * so a load builds instances times as many triangles.
+ *
+ * Blender files have position, normal, UV and color sources with triangulated <polylist>s indexing each of them,
+ * and textured materials. SketchUp files have <vertices> holding both POSITION and NORMAL, <triangles> with a
+ * UV source indexed by position, colored materials, IDn ids, and geometry instanced under nested group nodes.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <functional>
+using namespace std;
+
+typedef unsigned int u32;
+
+static FILE* out;
+static u32 seed = 12345;
+
+static u32 nextRandom() { // Linear congruential, so every platform makes the same file
+	seed = seed * 1664525u + 1013904223u;
+	return seed >> 8;
+}
+static float randomFloat(float min, float max) { return min + (max - min) * (float)(nextRandom() & 0xFFFF) / 65535.0f; }
+
+// Floats the way each exporter writes them: Blender with 6 digits, SketchUp with more and the odd exponent
+static void writeFloat(float f, bool sketchup) {
+	if (sketchup && (nextRandom() & 15) == 0) fprintf(out, "%e", f * 1e-4f);
+	else fprintf(out, sketchup ? "%.9g" : "%g", f);
+}
+// A <source> of count elements with a param for each letter of params. value(i) makes the i-th float, in order.
+static void writeSource(const string& id, const char* name, size_t count, const char* params, bool sketchup, const function<float(size_t)>& value) {
+	size_t stride = strlen(params);
+	fprintf(out, "<source id=\"%s\"", id.c_str());
+	if (name != NULL) fprintf(out, " name=\"%s\"", name);
+	fprintf(out, "><float_array id=\"%s-array\" count=\"%zu\">", id.c_str(), count * stride);
+	for (size_t i = 0; i < count * stride; i++) {
+		if (i) fputc(sketchup && i % stride == 0 ? '\n' : ' ', out);
+		writeFloat(value(i), sketchup);
+	}
+	fprintf(out, "</float_array><technique_common><accessor source=\"#%s-array\" count=\"%zu\" stride=\"%zu\">", id.c_str(), count, stride);
+	for (size_t i = 0; i < stride; i++) fprintf(out, "<param name=\"%c\" type=\"float\"/>", params[i]);
+	fprintf(out, "</accessor></technique_common></source>\n");
+}
+// Mostly +Z, so they're plausible for a heightfield
+static float bumpyNormal(size_t i) {
+	static float x, y;
+	if (i % 3 == 0) return x = randomFloat(-0.3f, 0.3f);
+	if (i % 3 == 1) return y = randomFloat(-0.3f, 0.3f);
+	return 1.0f - x * x - y * y;
+}
+
+/*
+ * A grid of quads, two triangles each, COLUMNS wide and as many rows as it takes. Neighbouring triangles
+ * share positions like a real mesh, and the heights are random so the normals aren't all the same.
+ */
+static const size_t COLUMNS = 32;
+static size_t gridPositions(size_t triangles) { return (COLUMNS + 1) * ((triangles + COLUMNS * 2 - 1) / (COLUMNS * 2) + 1); }
+static void gridTriangle(size_t t, u32* corners) {
+	size_t quad = t / 2, row = quad / COLUMNS, column = quad % COLUMNS;
+	u32 a = (u32)(row * (COLUMNS + 1) + column), b = a + 1, c = a + (u32)COLUMNS + 1, d = c + 1;
+	if (t % 2 == 0) { corners[0] = a; corners[1] = b; corners[2] = d; }
+	else { corners[0] = a; corners[1] = d; corners[2] = c; }
+}
+static float gridPosition(size_t i, float offset) {
+	size_t p = i / 3;
+	if (i % 3 == 0) return offset + (float)(p % (COLUMNS + 1));
+	if (i % 3 == 1) return (float)(p / (COLUMNS + 1));
+	return randomFloat(-0.5f, 0.5f);
+}
+
+static string materialId(bool sketchup, size_t m) {
+	char id[48];
+	snprintf(id, sizeof(id), sketchup ? "ID%zu" : "Material_%zu-material", sketchup ? m * 2 + 1 : m);
+	return id;
+}
+static string effectId(bool sketchup, size_t m) {
+	char id[48];
+	snprintf(id, sizeof(id), sketchup ? "ID%zu" : "Material_%zu-effect", sketchup ? m * 2 + 2 : m);
+	return id;
+}
+static string geometryId(bool sketchup, size_t g, size_t materials) {
+	char id[48];
+	snprintf(id, sizeof(id), sketchup ? "ID%zu" : "Object_%zu-mesh", sketchup ? materials * 2 + 1 + g : g);
+	return id;
+}
+
+static void writeMaterials(bool sketchup, size_t materials) {
+	if (!sketchup) {
+		fprintf(out, "<library_images>\n");
+		for (size_t m = 0; m < materials; m += 2)
+			fprintf(out, "<image id=\"texture_%zu_png\" name=\"texture_%zu_png\"><init_from>textures/texture_%zu.png</init_from></image>\n", m, m, m);
+		fprintf(out, "</library_images>\n");
+	}
+	fprintf(out, "<library_effects>\n");
+	for (size_t m = 0; m < materials; m++) {
+		fprintf(out, "<effect id=\"%s\"><profile_COMMON>", effectId(sketchup, m).c_str());
+		if (!sketchup && m % 2 == 0) { // Every other Blender material is textured
+			fprintf(out, "<newparam sid=\"texture_%zu_png-surface\"><surface type=\"2D\"><init_from>texture_%zu_png</init_from></surface></newparam>"
+				"<newparam sid=\"texture_%zu_png-sampler\"><sampler2D><source>texture_%zu_png-surface</source></sampler2D></newparam>"
+				"<technique sid=\"common\"><phong><diffuse><texture texture=\"texture_%zu_png-sampler\" texcoord=\"UVMap\"/></diffuse>", m, m, m, m, m);
+		} else {
+			fprintf(out, "<technique sid=\"%s\"><%s><diffuse><color%s>%g %g %g 1</color></diffuse>", sketchup ? "COMMON" : "common",
+				sketchup ? "lambert" : "phong", sketchup ? "" : " sid=\"diffuse\"", randomFloat(0, 1), randomFloat(0, 1), randomFloat(0, 1));
+		}
+		if (m % 3 == 0)
+			fprintf(out, "<transparent opaque=\"A_ONE\"><color>0 0 0 %g</color></transparent>", randomFloat(0.25f, 1.0f));
+		fprintf(out, "</%s></technique></profile_COMMON></effect>\n", sketchup ? "lambert" : "phong");
+	}
+	fprintf(out, "</library_effects>\n<library_materials>\n");
+	for (size_t m = 0; m < materials; m++)
+		fprintf(out, "<material id=\"%s\" name=\"%s%zu\"><instance_effect url=\"#%s\"/></material>\n", materialId(sketchup, m).c_str(),
+			sketchup ? "material_" : "Material_", m, effectId(sketchup, m).c_str());
+	fprintf(out, "</library_materials>\n");
+}
+
+static size_t primitivesOf(size_t materials) { return materials < 3 ? materials : 3; }
+
+static void writeBlenderGeometry(size_t g, size_t triangles, size_t materials) {
+	string id = geometryId(false, g, materials);
+	fprintf(out, "<geometry id=\"%s\" name=\"Object_%zu\"><mesh>\n", id.c_str(), g);
+	writeSource(id + "-positions", NULL, gridPositions(triangles), "XYZ", false, [g](size_t i) { return gridPosition(i, (float)g); });
+	writeSource(id + "-normals", NULL, triangles, "XYZ", false, bumpyNormal); // One per face
+	writeSource(id + "-map-0", NULL, triangles * 3, "ST", false, [](size_t) { return randomFloat(0, 1); }); // UVs and colors per corner
+	writeSource(id + "-colors-Col", "Col", triangles * 3, "RGB", false, [](size_t) { return randomFloat(0, 1); });
+	fprintf(out, "<vertices id=\"%s-vertices\"><input semantic=\"POSITION\" source=\"#%s-positions\"/></vertices>\n", id.c_str(), id.c_str());
+
+	size_t primitives = primitivesOf(materials);
+	for (size_t p = 0; p < primitives; p++) {
+		size_t first = triangles * p / primitives, end = triangles * (p + 1) / primitives;
+		fprintf(out, "<polylist material=\"%s\" count=\"%zu\"><input semantic=\"VERTEX\" source=\"#%s-vertices\" offset=\"0\"/>"
+			"<input semantic=\"NORMAL\" source=\"#%s-normals\" offset=\"1\"/><input semantic=\"TEXCOORD\" source=\"#%s-map-0\" offset=\"2\" set=\"0\"/>"
+			"<input semantic=\"COLOR\" source=\"#%s-colors-Col\" offset=\"3\" set=\"0\"/>\n<vcount>",
+			materialId(false, (g * primitives + p) % materials).c_str(), end - first, id.c_str(), id.c_str(), id.c_str(), id.c_str());
+		for (size_t t = first; t < end; t++) fputs("3 ", out);
+		fprintf(out, "</vcount>\n<p>");
+		for (size_t t = first; t < end; t++) {
+			u32 corners[3];
+			gridTriangle(t, corners);
+			for (int c = 0; c < 3; c++)
+				fprintf(out, t == first && c == 0 ? "%u %zu %zu %zu" : " %u %zu %zu %zu", corners[c], t, t * 3 + c, t * 3 + c);
+		}
+		fprintf(out, "</p></polylist>\n");
+	}
+	fprintf(out, "</mesh></geometry>\n");
+}
+
+static void writeSketchUpGeometry(size_t g, size_t triangles, size_t materials) {
+	string id = geometryId(true, g, materials);
+	size_t numPositions = gridPositions(triangles);
+	fprintf(out, "<geometry id=\"%s\"><mesh>\n", id.c_str());
+	writeSource(id + "-positions", NULL, numPositions, "XYZ", true, [](size_t i) { return gridPosition(i, 0.0f); });
+	writeSource(id + "-normals", NULL, numPositions, "XYZ", true, bumpyNormal); // Normals and UVs per position, like SketchUp's welded vertices
+	writeSource(id + "-uv", NULL, numPositions, "ST", true, [](size_t) { return randomFloat(-4, 4); });
+	fprintf(out, "<vertices id=\"%s-vertices\"><input semantic=\"POSITION\" source=\"#%s-positions\"/>"
+		"<input semantic=\"NORMAL\" source=\"#%s-normals\"/></vertices>\n", id.c_str(), id.c_str(), id.c_str());
+
+	size_t primitives = primitivesOf(materials);
+	for (size_t p = 0; p < primitives; p++) {
+		size_t first = triangles * p / primitives, end = triangles * (p + 1) / primitives;
+		fprintf(out, "<triangles count=\"%zu\" material=\"Material%zu\"><input offset=\"0\" semantic=\"VERTEX\" source=\"#%s-vertices\"/>"
+			"<input offset=\"1\" semantic=\"TEXCOORD\" source=\"#%s-uv\"/>\n<p>", end - first, p + 1, id.c_str(), id.c_str());
+		for (size_t t = first; t < end; t++) {
+			u32 corners[3];
+			gridTriangle(t, corners);
+			for (int c = 0; c < 3; c++)
+				fprintf(out, t == first && c == 0 ? "%u %u" : " %u %u", corners[c], corners[c]);
+		}
+		fprintf(out, "</p></triangles>\n");
+	}
+	fprintf(out, "</mesh></geometry>\n");
+}
+
+static void writeInstance(bool sketchup, size_t g, size_t instance, size_t materials) {
+	size_t primitives = primitivesOf(materials);
+	if (sketchup) fprintf(out, "<node id=\"ID%zu-%zu\" name=\"instance_%zu\"><matrix>1 0 0 %zu 0 1 0 %zu 0 0 1 0 0 0 0 1</matrix>", g, instance, instance, instance * 40, g);
+	else fprintf(out, "<node id=\"Object_%zu_%zu\" name=\"Object_%zu_%zu\" type=\"NODE\"><matrix sid=\"transform\">1 0 0 0 0 1 0 %zu 0 0 1 0 0 0 0 1</matrix>", g, instance, g, instance, instance * 40);
+	fprintf(out, "<instance_geometry url=\"#%s\"><bind_material><technique_common>", geometryId(sketchup, g, materials).c_str());
+	for (size_t p = 0; p < primitives; p++) {
+		size_t m = (g * primitives + p) % materials;
+		if (sketchup) fprintf(out, "<instance_material symbol=\"Material%zu\" target=\"#%s\"><bind_vertex_input semantic=\"UVSET0\" input_semantic=\"TEXCOORD\" input_set=\"0\"/></instance_material>", p + 1, materialId(true, m).c_str());
+		else fprintf(out, "<instance_material symbol=\"%s\" target=\"#%s\"><bind_vertex_input semantic=\"UVMap\" input_semantic=\"TEXCOORD\" input_set=\"0\"/></instance_material>", materialId(false, m).c_str(), materialId(false, m).c_str());
+	}
+	fprintf(out, "</technique_common></bind_material></instance_geometry></node>\n");
+}
+
+int main(int argc, char** argv) {
+	if (argc < 4 || (strcmp(argv[1], "blender") != 0 && strcmp(argv[1], "sketchup") != 0)) {
+		fprintf(stderr, "usage: %s <blender|sketchup> <triangles> <out.dae> [geometries] [materials] [instances]\n", argv[0]);
+		return 1;
+	}
+	bool sketchup = strcmp(argv[1], "sketchup") == 0;
+	size_t triangles = strtoul(argv[2], NULL, 10);
+	size_t geometries = argc > 4 ? strtoul(argv[4], NULL, 10) : triangles / 2000;
+	size_t materials = argc > 5 ? strtoul(argv[5], NULL, 10) : 16;
+	size_t instances = argc > 6 ? strtoul(argv[6], NULL, 10) : (sketchup ? 4 : 1);
+	if (geometries == 0) geometries = 1;
+	if (materials == 0) materials = 1;
+	if (triangles < geometries) triangles = geometries;
+	out = fopen(argv[3], "wb");
+	if (out == NULL) {
+		fprintf(stderr, "Could not open \"%s\"\n", argv[3]);
+		return 1;
+	}
+	setvbuf(out, NULL, _IOFBF, 1 << 20);
+
+	fprintf(out, "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n<COLLADA xmlns=\"http://www.collada.org/2005/11/COLLADASchema\" version=\"1.4.1\">\n");
+	if (sketchup) fprintf(out, "<asset><unit meter=\"0.0254\" name=\"inch\"/><up_axis>Z_UP</up_axis></asset>\n");
+	else fprintf(out, "<asset><unit name=\"meter\" meter=\"1\"/><up_axis>Z_UP</up_axis></asset>\n");
+	// SketchUp writes the scene before the libraries, Blender after
+	if (sketchup) {
+		fprintf(out, "<library_visual_scenes><visual_scene id=\"ID0\"><node name=\"SketchUp\">\n");
+		for (size_t g = 0; g < geometries; g++) {
+			fprintf(out, "<node name=\"group_%zu\">\n", g);
+			for (size_t i = 0; i < instances; i++) writeInstance(true, g, i, materials);
+			fprintf(out, "</node>\n");
+		}
+		fprintf(out, "</node></visual_scene></library_visual_scenes>\n");
+	}
+	if (!sketchup) writeMaterials(false, materials);
+	fprintf(out, "<library_geometries>\n");
+	for (size_t g = 0; g < geometries; g++) {
+		size_t count = triangles * (g + 1) / geometries - triangles * g / geometries;
+		if (sketchup) writeSketchUpGeometry(g, count, materials);
+		else writeBlenderGeometry(g, count, materials);
+	}
+	fprintf(out, "</library_geometries>\n");
+	if (sketchup) writeMaterials(true, materials);
+	else {
+		fprintf(out, "<library_visual_scenes><visual_scene id=\"Scene\" name=\"Scene\">\n");
+		for (size_t g = 0; g < geometries; g++)
+			for (size_t i = 0; i < instances; i++) writeInstance(false, g, i, materials);
+		fprintf(out, "</visual_scene></library_visual_scenes>\n");
+	}
+	fprintf(out, "<scene><instance_visual_scene url=\"#%s\"/></scene>\n</COLLADA>\n", sketchup ? "ID0" : "Scene");
+	bool written = ferror(out) == 0;
+	if (fclose(out) != 0 || !written) {
+		fprintf(stderr, "Could not write \"%s\"\n", argv[3]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,101 @@
+/*
+ * Times Model construction end to end and phase by phase. Prints one line of JSON per load: the fields of
+ * LoadStats::write(), plus the file, which run it was, how many triangles the Model ended up with and how many
+ * times operator new was called during the load (operatorNewCalls, everything the load allocated, with or without
+ * LoadOptions::allocator). Lines can be appended to a file and compared between builds for regression tracking.
+ *
+ *   g++ -std=c++11 -O2 -pthread -I. benchmark/load.cpp -o load
+ *   load [-r runs] file.dae...
+ *
+ * Each file is loaded 3 times unless -r says otherwise. generate.cpp makes files to run it on.
+ * Define LOAD_WITHOUT_STATS to build it against a SimpleCOLLADA.hpp from before LoadStats, which only gets
+ * totalMilliseconds and the fields added here. compare.sh does that for older revisions.
+ */
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <chrono>
+#include <iostream> // Before SimpleCOLLADA.hpp, which didn't include it itself until later
+#include <sstream>
+
+// Not inlined, so gcc doesn't take the malloc and free inside them for a mismatched new and delete
+#ifdef __GNUC__
+#define NOT_INLINED __attribute__((noinline))
+#else
+#define NOT_INLINED
+#endif
+
+static size_t operatorNewCalls = 0;
+NOT_INLINED void* operator new(size_t size) {
+	operatorNewCalls++;
+	void* memory = malloc(size > 0 ? size : 1);
+	if (memory == NULL) throw std::bad_alloc();
+	return memory;
+}
+NOT_INLINED void operator delete(void* memory) noexcept { free(memory); }
+NOT_INLINED void operator delete(void* memory, size_t) noexcept { free(memory); }
+
+#ifndef LOAD_WITHOUT_STATS
+#define SIMPLECOLLADA_ENABLE_STATS
+#endif
+#include "SimpleCOLLADA/SimpleCOLLADA.hpp"
+using namespace std;
+
+#ifdef LOAD_WITHOUT_STATS
+namespace SimpleCOLLADA {
+	// Older headers don't have it. Nothing else is needed for a file name.
+	inline void writeJSONString(ostream& out, const string& str) {
+		out << '"';
+		for (size_t i = 0; i < str.size(); i++) {
+			if (str[i] == '"' || str[i] == '\\') out << '\\';
+			out << str[i];
+		}
+		out << '"';
+	}
+}
+#endif
+
+int main(int argc, char** argv) {
+	int runs = 3;
+	vector<const char*> files;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-r") == 0 && i + 1 < argc) runs = atoi(argv[++i]);
+		else files.push_back(argv[i]);
+	}
+	if (files.empty()) {
+		cerr << "usage: " << argv[0] << " [-r runs] file.dae..." << endl;
+		return 1;
+	}
+	for (size_t f = 0; f < files.size(); f++) {
+		for (int run = 0; run < runs; run++) {
+			size_t callsBefore = operatorNewCalls;
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			SimpleCOLLADA::Model model(files[f]);
+			double milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+			size_t calls = operatorNewCalls - callsBefore;
+#ifndef LOAD_WITHOUT_STATS
+			if (!model.error.empty())
+				return 1; // The Model has said why
+#endif
+			size_t triangles = 0;
+			for (size_t n = 0; n < model.modelNodes.size(); n++)
+				triangles += model.modelNodes[n]->getNumOfTriangles();
+
+#ifndef LOAD_WITHOUT_STATS
+			// LoadStats' object, with this run's fields added before its closing brace
+			(void)milliseconds;
+			ostringstream stats;
+			model.getStats().write(stats);
+			string line = stats.str();
+			line.erase(line.rfind('}'));
+			cout << line << ",";
+#else
+			cout << "{\"totalMilliseconds\":" << milliseconds << ",";
+#endif
+			cout << "\"file\":";
+			SimpleCOLLADA::writeJSONString(cout, files[f]);
+			cout << ",\"run\":" << run << ",\"triangles\":" << triangles << ",\"operatorNewCalls\":" << calls << "}" << endl;
+		}
+	}
+	return 0;
+}
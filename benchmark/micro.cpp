@@ -0,0 +1,186 @@
+/*
+ * Times the loader's parsing functions on their own: read_floats, read_u32s, findAttribute and buildIdIndex from
+ * SimpleCOLLADA::detail, decoding a triangle group from its <p> and sources, and ModelNode destruction.
+ * Prints one line of JSON per benchmark and input, with nanoseconds and operator new calls per element.
+ * Each function has a single scalar implementation (strtof, strtoul and rapidxml), so there are no variants to pick between.
+ *
+ *   g++ -std=c++11 -O2 -pthread -I. benchmark/micro.cpp -o micro
+ *   micro [file.dae...]
+ *
+ * The number parsers and findAttribute run on inputs made here. buildIdIndex, decoding and destruction
+ * run on each file given, such as the Blender and SketchUp files from generate.cpp. Decoding and destruction go through
+ * the public API: the file is loaded with LoadOptions::lazyDecoding, and every ModelNode is then decoded and deleted.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <chrono>
+#include <iterator>
+
+// Not inlined, so gcc doesn't take the malloc and free inside them for a mismatched new and delete
+#ifdef __GNUC__
+#define NOT_INLINED __attribute__((noinline))
+#else
+#define NOT_INLINED
+#endif
+
+static size_t allocations = 0;
+NOT_INLINED void* operator new(size_t size) {
+	allocations++;
+	void* memory = malloc(size > 0 ? size : 1);
+	if (memory == NULL) throw std::bad_alloc();
+	return memory;
+}
+NOT_INLINED void operator delete(void* memory) noexcept { free(memory); }
+NOT_INLINED void operator delete(void* memory, size_t) noexcept { free(memory); }
+
+#include "SimpleCOLLADA/SimpleCOLLADA.hpp"
+
+namespace SimpleCOLLADA {
+	struct MicroBenchmark {
+		static const int RUNS = 5; // The fastest run is reported
+
+		static u32 nextRandom() { // Same inputs every time
+			static u32 seed = 12345;
+			seed = seed * 1664525u + 1013904223u;
+			return seed >> 8;
+		}
+		static void report(const char* benchmark, const string& input, size_t elements, double nanoseconds, size_t allocated) {
+			cout << "{\"benchmark\":\"" << benchmark << "\",\"input\":";
+			writeJSONString(cout, input);
+			cout << ",\"elements\":" << elements << ",\"nsPerElement\":" << (elements > 0 ? nanoseconds / elements : 0.0)
+				<< ",\"allocationsPerElement\":" << (elements > 0 ? (double)allocated / elements : 0.0) << "}" << endl;
+		}
+		// Runs work RUNS times and reports the fastest, with the allocations of the last run. work returns the element count.
+		template<typename Work>
+		static void run(const char* benchmark, const string& input, Work work) {
+			double best = 0.0;
+			size_t elements = 0, allocated = 0;
+			for (int r = 0; r < RUNS; r++) {
+				size_t before = allocations;
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				elements = work();
+				double nanoseconds = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+				allocated = allocations - before;
+				if (r == 0 || nanoseconds < best) best = nanoseconds;
+			}
+			report(benchmark, input, elements, best, allocated);
+		}
+
+		// count numbers made by number(), separated by single spaces, or by runs of mixed whitespace if mixed is set
+		template<typename Number>
+		static string numbers(size_t count, bool mixed, Number number) {
+			static const char* separators[4] = { " ", "\n", "\t", "  \n\t " };
+			string text;
+			char buffer[32];
+			for (size_t i = 0; i < count; i++) {
+				if (i) text += mixed ? separators[nextRandom() & 3] : " ";
+				number(buffer, sizeof(buffer));
+				text += buffer;
+			}
+			return text;
+		}
+
+		static void numberParsers() {
+			const size_t COUNT = 1000000;
+			vector<pair<string, string>> floats;
+			floats.push_back(make_pair("short", numbers(COUNT, false, [](char* b, size_t n) { snprintf(b, n, "%g", (float)(nextRandom() % 21) * 0.5f - 5.0f); })));
+			floats.push_back(make_pair("long", numbers(COUNT, false, [](char* b, size_t n) { snprintf(b, n, "%.9g", (float)nextRandom() / 8388.608f - 1000.0f); })));
+			floats.push_back(make_pair("scientific", numbers(COUNT, false, [](char* b, size_t n) { snprintf(b, n, "%e", (float)nextRandom() * 1e-12f); })));
+			floats.push_back(make_pair("mixed whitespace", numbers(COUNT, true, [](char* b, size_t n) { snprintf(b, n, "%g", (float)nextRandom() / 16777.216f); })));
+			vector<float> floatValues(COUNT);
+			for (size_t i = 0; i < floats.size(); i++) {
+				const char* text = floats[i].second.c_str();
+				run("read_floats", floats[i].first, [&]() { const char* str = text; return detail::read_floats(str, floatValues.data(), COUNT); });
+			}
+
+			vector<pair<string, string>> indices;
+			indices.push_back(make_pair("short", numbers(COUNT, false, [](char* b, size_t n) { snprintf(b, n, "%u", nextRandom() % 1000); })));
+			indices.push_back(make_pair("long", numbers(COUNT, false, [](char* b, size_t n) { snprintf(b, n, "%u", nextRandom() * 200u); })));
+			indices.push_back(make_pair("mixed whitespace", numbers(COUNT, true, [](char* b, size_t n) { snprintf(b, n, "%u", nextRandom() % 100000); })));
+			vector<u32> indexValues(COUNT);
+			for (size_t i = 0; i < indices.size(); i++) {
+				const char* text = indices[i].second.c_str();
+				run("read_u32s", indices[i].first, [&]() { const char* str = text; return detail::read_u32s(str, indexValues.data(), COUNT); });
+			}
+		}
+
+		static void attributes() {
+			const size_t LOOKUPS = 1000000;
+			char text[] = "<input semantic=\"TEXCOORD\" source=\"#Cube-mesh-map-0\" offset=\"2\" set=\"0\"/>";
+			xml_document<> doc;
+			doc.parse<0>(text);
+			xml_node<>* input = doc.first_node();
+			const char* names[3] = { "semantic", "set", "count" };
+			const char* inputs[3] = { "first of 4", "last of 4", "missing" };
+			for (int n = 0; n < 3; n++) {
+				run("findAttribute", inputs[n], [&]() {
+					size_t found = 0;
+					for (size_t i = 0; i < LOOKUPS; i++)
+						found += EXISTS(detail::findAttribute(input, names[n])) ? 1 : 0;
+					if (found > LOOKUPS) cout << found; // Keeps the loop from being optimized away
+					return LOOKUPS;
+				});
+			}
+		}
+
+		static void file(const char* filename) {
+			ifstream in(filename, ios::binary);
+			if (!in) {
+				cout << "Could not open " << filename << endl;
+				return;
+			}
+			vector<char> text((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+			text.push_back('\0');
+			xml_document<> doc;
+			try {
+				doc.parse<0>(text.data());
+			} catch (const parse_error& e) {
+				cout << "Could not parse " << filename << ": " << e.what() << endl;
+				return;
+			}
+			xml_node<>* COLLADA = doc.first_node("COLLADA");
+			if (!EXISTS(COLLADA)) return;
+
+			run("buildIdIndex", filename, [&]() {
+				IdIndex index; // New each time, so its growth is counted too
+				return detail::buildIdIndex(index, COLLADA, "id");
+			});
+
+			// Every triangle group the scene instances. The lazy load only finds them, and getNumOfVertices() decodes each one.
+			LoadOptions options;
+			options.lazyDecoding = true;
+			size_t triangles = 0, decodeAllocations = 0, destructionAllocations = 0;
+			double bestDecode = 0.0, bestDestruction = 0.0;
+			for (int r = 0; r < RUNS; r++) {
+				Model model(filename, options);
+				size_t before = allocations;
+				chrono::steady_clock::time_point start = chrono::steady_clock::now();
+				for (size_t n = 0; n < model.modelNodes.size(); n++)
+					model.modelNodes[n]->getNumOfVertices();
+				double decode = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+				decodeAllocations = allocations - before;
+				triangles = 0;
+				for (size_t n = 0; n < model.modelNodes.size(); n++) triangles += model.modelNodes[n]->getNumOfTriangles();
+				before = allocations;
+				start = chrono::steady_clock::now();
+				for (size_t n = 0; n < model.modelNodes.size(); n++) delete model.modelNodes[n];
+				double destruction = (double)chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+				destructionAllocations = allocations - before;
+				model.modelNodes.clear();
+				if (r == 0 || decode < bestDecode) bestDecode = decode;
+				if (r == 0 || destruction < bestDestruction) bestDestruction = destruction;
+			}
+			report("decode", filename, triangles, bestDecode, decodeAllocations);
+			report("~ModelNode", filename, triangles, bestDestruction, destructionAllocations);
+		}
+	};
+}
+
+int main(int argc, char** argv) {
+	SimpleCOLLADA::MicroBenchmark::numberParsers();
+	SimpleCOLLADA::MicroBenchmark::attributes();
+	for (int i = 1; i < argc; i++)
+		SimpleCOLLADA::MicroBenchmark::file(argv[i]);
+	return 0;
+}